@@ -0,0 +1,83 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Worst single rbtree_erase on a 1M-key lazy-erase tree with ratio 0.25,
+// erasing every key in random order. The "compact at ratio" line calls
+// rbtree_compact whenever the ratio is crossed, which is what erase used to
+// do by itself; the lazy line is the incremental sweep erase does now.
+// Exits non-zero if the sweep's worst erase is not well below a compaction.
+
+#define N 1000000
+#define RATIO 0.25
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+  double total, worst;
+} erase_cost_t;
+
+static erase_cost_t run(const key_t *keys, const key_t *order,
+                        const double ratio, const int compact) {
+  rbtree *t = new_rbtree();
+  if (ratio >= 0) {
+    rbtree_enable_lazy_erase(t, compact ? 0 : ratio);
+  }
+  for (int i = 0; i < N; i++) {
+    rbtree_insert(t, keys[i]);
+  }
+
+  erase_cost_t cost = {0, 0};
+  for (int i = 0; i < N; i++) {
+    node_t *p = rbtree_find(t, order[i]);
+    const double start = now();
+    rbtree_erase(t, p);
+    if (compact && t->tombstones > ratio * t->count) {
+      rbtree_compact(t);
+    }
+    const double d = now() - start;
+    cost.total += d;
+    if (d > cost.worst) {
+      cost.worst = d;
+    }
+  }
+  delete_rbtree(t);
+  return cost;
+}
+
+int main(void) {
+  key_t *keys = calloc(N, sizeof(key_t));
+  key_t *order = calloc(N, sizeof(key_t));
+  srand(11);
+  for (int i = 0; i < N; i++) {
+    keys[i] = order[i] = rand();
+  }
+  for (int i = N - 1; i > 0; i--) {
+    const int j = rand() % (i + 1);
+    const key_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  const erase_cost_t plain = run(keys, order, -1, 0);
+  const erase_cost_t compact = run(keys, order, RATIO, 1);
+  const erase_cost_t lazy = run(keys, order, RATIO, 0);
+  printf("%d random erases, ratio %.2f\n", N, RATIO);
+  printf("  plain erase        total %7.3f s   worst %8.3f ms\n", plain.total,
+         plain.worst * 1e3);
+  printf("  compact at ratio   total %7.3f s   worst %8.3f ms\n",
+         compact.total, compact.worst * 1e3);
+  printf("  lazy erase         total %7.3f s   worst %8.3f ms\n", lazy.total,
+         lazy.worst * 1e3);
+
+  free(order);
+  free(keys);
+  // a sweep is a handful of O(log n) removals, a compaction touches every
+  // node; a factor of 10 leaves room for a descheduled erase on a busy box
+  return lazy.worst * 10 < compact.worst ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Lookup mixes where most keys are absent, with and without the filter.
+// The tree holds N even keys, misses are odd keys.
+
+#define N 1000000
+#define LOOKUPS 5000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run(rbtree *t, const key_t *queries) {
+  long hits = 0;
+  const double start = now();
+  for (int i = 0; i < LOOKUPS; i++) {
+    hits += rbtree_find(t, queries[i]) != NULL;
+  }
+  const double elapsed = now() - start;
+  return hits >= 0 ? elapsed : 0;
+}
+
+int main(void) {
+  key_t *keys = calloc(N, sizeof(key_t));
+  key_t *queries = calloc(LOOKUPS, sizeof(key_t));
+  rbtree *plain = new_rbtree();
+  rbtree *filtered = new_rbtree();
+  const int miss_pct[] = {50, 90, 99};
+
+  srand(1);
+  rbtree_enable_filter(filtered, N);
+  for (int i = 0; i < N; i++) {
+    keys[i] = (rand() % (1 << 28)) * 2;
+    rbtree_insert(plain, keys[i]);
+    rbtree_insert(filtered, keys[i]);
+  }
+
+  printf("rbtree_find, %d keys, %d lookups\n", N, LOOKUPS);
+  for (int m = 0; m < 3; m++) {
+    for (int i = 0; i < LOOKUPS; i++) {
+      const key_t key = keys[rand() % N];
+      queries[i] = (rand() % 100 < miss_pct[m]) ? key + 1 : key;
+    }
+    printf("  %2d%% misses   no filter %7.3f s   filter %7.3f s\n",
+           miss_pct[m], run(plain, queries), run(filtered, queries));
+  }
+
+  filter_stats_t stats;
+  rbtree_filter_stats(filtered, &stats);
+  printf("filter: %zu bytes (%.1f bits/key), %zu queries, %zu rejected, "
+         "%zu false positives, fp rate %.4f%%\n",
+         stats.bytes, stats.bytes * 8.0 / N, stats.queries, stats.negatives,
+         stats.false_positives, stats.fp_rate * 100);
+
+  delete_rbtree(filtered);
+  delete_rbtree(plain);
+  free(queries);
+  free(keys);
+}
@@ -0,0 +1,109 @@
+#include <linux/perf_event.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Random lookups in a large tree with heap nodes and with the huge page
+// node arena. Reports memory usage, lookup latency and dTLB load misses
+// (from perf_event_open, "n/a" when the counter is unavailable).
+// Usage: bench-hugepages [nodes], default 10^7.
+
+#define LOOKUPS 5000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int dtlb_counter(void) {
+  struct perf_event_attr attr = {0};
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void run(const char *name, rbtree *t, const key_t *queries) {
+  const int fd = dtlb_counter();
+  long hits = 0;
+
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  const double start = now();
+  for (int i = 0; i < LOOKUPS; i++) {
+    hits += rbtree_find(t, queries[i]) != NULL;
+  }
+  const double elapsed = now() - start;
+
+  long long misses = -1;
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &misses, sizeof(misses)) != sizeof(misses)) {
+      misses = -1;
+    }
+    close(fd);
+  }
+
+  const memory_usage_t usage = rbtree_memory_usage(t);
+  printf("  %-6s %7.1f MB used %7.1f MB reserved (%4.1f%% frag)  %6.1f ns/lookup",
+         name, usage.used / 1048576.0, usage.reserved / 1048576.0,
+         usage.fragmentation * 100, elapsed * 1e9 / LOOKUPS);
+  if (misses >= 0) {
+    printf("  %5.2f dTLB misses/lookup\n", (double)misses / LOOKUPS);
+  } else {
+    printf("  dTLB n/a\n");
+  }
+  if (hits != LOOKUPS) {
+    printf("  (%ld lookups missed)\n", LOOKUPS - hits);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+  key_t *keys = calloc(n, sizeof(key_t));
+  key_t *queries = calloc(LOOKUPS, sizeof(key_t));
+
+  srand(1);
+  for (size_t i = 0; i < n; i++) {
+    keys[i] = rand();
+  }
+  for (int i = 0; i < LOOKUPS; i++) {
+    queries[i] = keys[rand() % n];
+  }
+
+  printf("%zu nodes, %d random lookups\n", n, LOOKUPS);
+
+  rbtree *heap = new_rbtree();
+  for (size_t i = 0; i < n; i++) {
+    rbtree_insert(heap, keys[i]);
+  }
+  run("heap", heap, queries);
+  delete_rbtree(heap);
+
+  rbtree *arena = new_rbtree();
+  rbtree_enable_hugepages(arena);
+  for (size_t i = 0; i < n; i++) {
+    rbtree_insert(arena, keys[i]);
+  }
+  run("arena", arena, queries);
+  if (!rbtree_memory_usage(arena).hugepages) {
+    printf("  (MADV_HUGEPAGE was refused, arena uses base pages)\n");
+  }
+  delete_rbtree(arena);
+
+  free(keys);
+  free(queries);
+  return 0;
+}
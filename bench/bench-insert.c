@@ -0,0 +1,69 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Bulk load with sorted, reverse-sorted, jittered (near-sorted) and random
+// keys. The random case checks that the finger costs nothing when it
+// cannot help.
+// bench-insert-root is the same program built with -DRBTREE_NO_FINGER, so
+// every insert descends from the root.
+
+#define N 2000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run_once(const key_t *keys, const int use_hint) {
+  rbtree *t = new_rbtree();
+  node_t *hint = NULL;
+  const double start = now();
+  for (int i = 0; i < N; i++) {
+    if (use_hint) {
+      hint = rbtree_insert_hint(t, hint, keys[i]);
+    } else {
+      rbtree_insert(t, keys[i]);
+    }
+  }
+  const double elapsed = now() - start;
+  delete_rbtree(t);
+  return elapsed;
+}
+
+// best of three, the first run also pays for page faults
+static double run(const key_t *keys, const int use_hint) {
+  double best = run_once(keys, use_hint);
+  for (int i = 0; i < 2; i++) {
+    const double elapsed = run_once(keys, use_hint);
+    best = elapsed < best ? elapsed : best;
+  }
+  return best;
+}
+
+int main(void) {
+  key_t *keys = calloc(N, sizeof(key_t));
+  const char *names[] = {"sorted", "reverse", "jittered", "random"};
+
+  srand(1);
+  printf("bulk load, %d keys\n", N);
+  for (int pattern = 0; pattern < 4; pattern++) {
+    for (int i = 0; i < N; i++) {
+      if (pattern == 0) {
+        keys[i] = i;
+      } else if (pattern == 1) {
+        keys[i] = N - i;
+      } else if (pattern == 2) {
+        keys[i] = i * 16 + rand() % 256;  // out of order within ~16 keys
+      } else {
+        keys[i] = rand();
+      }
+    }
+    printf("  %-10s rbtree_insert %8.3f s   rbtree_insert_hint %8.3f s\n",
+           names[pattern], run(keys, 0), run(keys, 1));
+  }
+
+  free(keys);
+}
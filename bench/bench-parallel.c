@@ -0,0 +1,89 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Scaling of rbtree_to_array_parallel and rbtree_parallel_reduce from one
+// thread up to the number of online CPUs (best of 3 per point). One thread
+// runs the same stack walk as the pieces, so xN compares like with like;
+// the to_array line is the parent-pointer walk for reference.
+
+#define N 4000000
+#define BUCKETS 256
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void hist_map(void *acc, const key_t key, void *arg) {
+  ((long *)acc)[key & (BUCKETS - 1)]++;
+}
+
+static void hist_combine(void *acc, const void *other, void *arg) {
+  for (int i = 0; i < BUCKETS; i++) {
+    ((long *)acc)[i] += ((const long *)other)[i];
+  }
+}
+
+static double best_export(rbtree *t, key_t *arr, int threads) {
+  double best = 1e9;
+  for (int r = 0; r < 3; r++) {
+    const double start = now();
+    if (threads == 0) {
+      rbtree_to_array(t, arr, N);
+    } else {
+      rbtree_to_array_parallel(t, arr, N, threads);
+    }
+    const double elapsed = now() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  return best;
+}
+
+static double best_reduce(rbtree *t, int threads) {
+  double best = 1e9;
+  long hist[BUCKETS];
+  for (int r = 0; r < 3; r++) {
+    memset(hist, 0, sizeof(hist));
+    const double start = now();
+    rbtree_parallel_reduce(t, hist, sizeof(hist), hist_map, hist_combine, NULL,
+                           threads);
+    const double elapsed = now() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  return best;
+}
+
+int main(void) {
+  rbtree *t = new_rbtree();
+  key_t *arr = calloc(N, sizeof(key_t));
+  const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  srand(1);
+  for (int i = 0; i < N; i++) {
+    rbtree_insert(t, rand());
+  }
+
+  const double serial = best_export(t, arr, 0);
+  printf("%d keys, %ld online CPUs\n", N, cpus);
+  printf("  to_array            %7.3f s\n", serial);
+  double base_export = 0, base_reduce = 0;
+  for (int threads = 1; threads <= (cpus > 1 ? cpus : 2); threads *= 2) {
+    const double e = best_export(t, arr, threads);
+    const double r = best_reduce(t, threads);
+    if (threads == 1) {
+      base_export = e;
+      base_reduce = r;
+    }
+    printf("  %2d threads  export %7.3f s (x%.2f)   histogram %7.3f s (x%.2f)\n",
+           threads, e, base_export / e, r, base_reduce / r);
+  }
+
+  delete_rbtree(t);
+  free(arr);
+  return 0;
+}
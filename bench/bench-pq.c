@@ -0,0 +1,176 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Scheduler-queue workload: fill with N keys, then N hold operations
+// (pop the smallest key and push it back a bit later), then drain.
+// The root-descent line finds the minimum by walking left from the root,
+// the way rbtree_min worked before the extremes were cached, so it is the
+// two-descent baseline; rbtree_min + rbtree_erase already uses the cache.
+
+#define N 1000000
+
+static volatile long long sink;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+  key_t *a;
+  size_t n;
+} heap_t;
+
+static void heap_push(heap_t *h, const key_t key) {
+  size_t i = h->n++;
+  while (i > 0 && h->a[(i - 1) / 2] > key) {
+    h->a[i] = h->a[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  h->a[i] = key;
+}
+
+static key_t heap_pop(heap_t *h) {
+  const key_t top = h->a[0];
+  const key_t last = h->a[--h->n];
+  size_t i = 0;
+  for (;;) {
+    size_t c = 2 * i + 1;
+    if (c >= h->n) {
+      break;
+    }
+    if (c + 1 < h->n && h->a[c + 1] < h->a[c]) {
+      c++;
+    }
+    if (h->a[c] >= last) {
+      break;
+    }
+    h->a[i] = h->a[c];
+    i = c;
+  }
+  h->a[i] = last;
+  return top;
+}
+
+static double run_heap(const key_t *keys, const key_t *delays) {
+  heap_t h = {calloc(N, sizeof(key_t)), 0};
+  long long sum = 0;
+  const double start = now();
+  for (int i = 0; i < N; i++) {
+    heap_push(&h, keys[i]);
+  }
+  for (int i = 0; i < N; i++) {
+    const key_t key = heap_pop(&h);
+    heap_push(&h, key + delays[i]);
+  }
+  while (h.n > 0) {
+    sum += heap_pop(&h);
+  }
+  const double elapsed = now() - start;
+  sink = sum;
+  free(h.a);
+  return elapsed;
+}
+
+enum { USE_DESCENT, USE_MIN, USE_POP };
+
+// leftmost node found by walking down from the root
+static node_t *descend_min(const rbtree *t) {
+  node_t *p = t->root;
+  while (p->left != t->nil) {
+    p = p->left;
+  }
+  return p;
+}
+
+static double run_rbtree(const key_t *keys, const key_t *delays,
+                         const int mode) {
+  rbtree *t = new_rbtree();
+  key_t key;
+  const double start = now();
+  for (int i = 0; i < N; i++) {
+    rbtree_insert(t, keys[i]);
+  }
+  for (int i = 0; i < N; i++) {
+    if (mode == USE_POP) {
+      rbtree_pop_min(t, &key);
+    } else {
+      // previous pattern: find the minimum, then erase it
+      node_t *p = mode == USE_MIN ? rbtree_min(t) : descend_min(t);
+      key = p->key;
+      rbtree_erase(t, p);
+    }
+    rbtree_insert(t, key + delays[i]);
+  }
+  if (mode == USE_POP) {
+    while (rbtree_pop_min(t, &key) == 0) {
+    }
+  } else {
+    while (t->root != t->nil) {
+      rbtree_erase(t, mode == USE_MIN ? rbtree_min(t) : descend_min(t));
+    }
+  }
+  const double elapsed = now() - start;
+  delete_rbtree(t);
+  return elapsed;
+}
+
+// node is reused, so decrease-key is compared with an erase + insert pair
+static double run_update(const key_t *keys, const key_t *delays,
+                         const int use_update) {
+  rbtree *t = new_rbtree();
+  node_t **nodes = calloc(N, sizeof(node_t *));
+  for (int i = 0; i < N; i++) {
+    rbtree_insert(t, keys[i]);
+  }
+  int i = 0;
+  for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) {
+    nodes[i++] = p;
+  }
+
+  const double start = now();
+  for (i = 0; i < N; i++) {
+    node_t *p = nodes[(size_t)keys[i] % N];
+    const key_t key = p->key - delays[i];
+    if (use_update) {
+      rbtree_update_key(t, p, key);
+    } else {
+      rbtree_erase(t, p);
+      rbtree_insert(t, key);
+      nodes[(size_t)keys[i] % N] = rbtree_find(t, key);
+    }
+  }
+  const double elapsed = now() - start;
+  free(nodes);
+  delete_rbtree(t);
+  return elapsed;
+}
+
+int main(void) {
+  key_t *keys = calloc(N, sizeof(key_t));
+  key_t *delays = calloc(N, sizeof(key_t));
+  srand(1);
+  for (int i = 0; i < N; i++) {
+    keys[i] = rand() % (1 << 28);
+    delays[i] = rand() % 1024;
+  }
+
+  printf("priority queue, %d keys + %d hold ops + drain\n", N, N);
+  printf("  %-28s %8.3f s\n", "binary heap", run_heap(keys, delays));
+  printf("  %-28s %8.3f s\n", "root descent + rbtree_erase",
+         run_rbtree(keys, delays, USE_DESCENT));
+  printf("  %-28s %8.3f s\n", "rbtree_min + rbtree_erase",
+         run_rbtree(keys, delays, USE_MIN));
+  printf("  %-28s %8.3f s\n", "rbtree_pop_min",
+         run_rbtree(keys, delays, USE_POP));
+  printf("decrease-key, %d ops on %d keys\n", N, N);
+  printf("  %-28s %8.3f s\n", "rbtree_erase + rbtree_insert",
+         run_update(keys, delays, 0));
+  printf("  %-28s %8.3f s\n", "rbtree_update_key", run_update(keys, delays, 1));
+
+  free(delays);
+  free(keys);
+}
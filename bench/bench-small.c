@@ -0,0 +1,70 @@
+#include <malloc.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Many tiny trees: N_TREES trees of KEYS keys each, then FINDS lookups of
+// present keys in random trees. Heap bytes per tree come from mallinfo2, so
+// they include allocator headers. bench-small links the library built with
+// -DRBTREE_SMALL_MODE, bench-small-plain the default build.
+
+#define N_TREES 100000
+#define KEYS 8
+#define FINDS 2000000
+
+static volatile long long sink;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  rbtree **trees = calloc(N_TREES, sizeof(rbtree *));
+  key_t *keys = calloc((size_t)N_TREES * KEYS, sizeof(key_t));
+  int *which = calloc(FINDS, sizeof(int));
+  srand(5);
+  for (size_t i = 0; i < (size_t)N_TREES * KEYS; i++) {
+    keys[i] = rand();
+  }
+  for (int i = 0; i < FINDS; i++) {
+    which[i] = rand() % (N_TREES * KEYS);
+  }
+
+  const size_t before = mallinfo2().uordblks;
+  for (int i = 0; i < N_TREES; i++) {
+    trees[i] = new_rbtree();
+    for (int k = 0; k < KEYS; k++) {
+      rbtree_insert(trees[i], keys[i * KEYS + k]);
+    }
+  }
+  const size_t after = mallinfo2().uordblks;
+
+  // best of 3
+  double best = 1e9;
+  for (int r = 0; r < 3; r++) {
+    long long sum = 0;
+    const double start = now();
+    for (int i = 0; i < FINDS; i++) {
+      const node_t *p = rbtree_find(trees[which[i] / KEYS], keys[which[i]]);
+      sum += p->key;
+    }
+    const double d = now() - start;
+    sink = sum;
+    if (d < best) {
+      best = d;
+    }
+  }
+
+  printf("%d trees of %d keys: %6.1f B per tree, %d finds %.3f s\n", N_TREES,
+         KEYS, (double)(after - before) / N_TREES, FINDS, best);
+
+  for (int i = 0; i < N_TREES; i++) {
+    delete_rbtree(trees[i]);
+  }
+  free(which);
+  free(keys);
+  free(trees);
+}
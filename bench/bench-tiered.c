@@ -0,0 +1,103 @@
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Tiered mode against a plain tree: load N random keys, then look up a
+// mix of present and absent keys. Prints resident bytes and per-lookup
+// latency percentiles. Run files go to a temporary directory on local disk
+// and are usually in the page cache, so this measures index and filter
+// cost, not the device.
+
+#define N 4000000
+#define BUFFER_KEYS 65536
+#define LOOKUPS 200000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  const double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void report(const char *name, double *lat) {
+  qsort(lat, LOOKUPS, sizeof(double), cmp_double);
+  printf("  %-7s p50 %6.2f us   p99 %6.2f us   p999 %6.2f us\n", name,
+         lat[LOOKUPS / 2] * 1e6, lat[LOOKUPS * 99 / 100] * 1e6,
+         lat[LOOKUPS * 999 / 1000] * 1e6);
+}
+
+int main(void) {
+  char dir[] = "/tmp/rbtree-bench-XXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  key_t *keys = calloc(N, sizeof(key_t));
+  key_t *queries = calloc(LOOKUPS, sizeof(key_t));
+  double *lat = calloc(LOOKUPS, sizeof(double));
+  rbtree *plain = new_rbtree();
+  const memory_usage_t empty = rbtree_memory_usage(plain);
+  rbtree_tiered *tt = rbtree_tiered_open(dir, BUFFER_KEYS);
+
+  srand(1);
+  double start = now();
+  for (int i = 0; i < N; i++) {
+    keys[i] = (rand() % (1 << 28)) * 2;
+    rbtree_insert(plain, keys[i]);
+  }
+  const double plain_load = now() - start;
+  start = now();
+  for (int i = 0; i < N; i++) {
+    rbtree_tiered_insert(tt, keys[i]);
+  }
+  const double tiered_load = now() - start;
+
+  for (int i = 0; i < LOOKUPS; i++) {
+    const key_t key = keys[rand() % N];
+    queries[i] = rand() % 2 ? key + 1 : key;  // half absent
+  }
+
+  tiered_stats_t stats;
+  rbtree_tiered_stats(tt, &stats);
+  printf("%d keys, buffer %d keys, %zu runs after %zu merges\n", N,
+         BUFFER_KEYS, stats.runs, stats.merges);
+  printf("  load    plain %6.3f s   tiered %6.3f s\n", plain_load, tiered_load);
+  // tiered holds at most BUFFER_KEYS nodes across its two buffer trees, each
+  // costing what a node costs the allocator in the plain tree, plus the index
+  const memory_usage_t usage = rbtree_memory_usage(plain);
+  const double node_bytes = (double)(usage.reserved - empty.reserved) / usage.nodes;
+  const double buffer_bytes = 2.0 * empty.reserved + BUFFER_KEYS * node_bytes;
+  printf("  memory  plain %6.1f MB  tiered %6.1f MB (%.1f MB buffer + %.1f MB index)\n",
+         (double)usage.reserved / (1 << 20),
+         (buffer_bytes + stats.index_bytes) / (1 << 20), buffer_bytes / (1 << 20),
+         (double)stats.index_bytes / (1 << 20));
+
+  long hits = 0;
+  for (int i = 0; i < LOOKUPS; i++) {
+    const double t0 = now();
+    hits += rbtree_find(plain, queries[i]) != NULL;
+    lat[i] = now() - t0;
+  }
+  report("plain", lat);
+  for (int i = 0; i < LOOKUPS; i++) {
+    const double t0 = now();
+    hits -= rbtree_tiered_count(tt, queries[i]) > 0;
+    lat[i] = now() - t0;
+  }
+  report("tiered", lat);
+
+  rbtree_tiered_close(tt);
+  delete_rbtree(plain);
+  rmdir(dir);
+  free(keys);
+  free(queries);
+  free(lat);
+  return hits == 0 ? 0 : 1;
+}
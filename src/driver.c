@@ -1,5 +1,445 @@
 #include "rbtree.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
-int main(int argc, char *argv[]) {
+// 호출 기록 재생 도구
+// rbtree_trace_start로 남긴 바이너리 기록이나 사람이 쓴 텍스트 기록을 빈 트리에 그대로 재생하고
+// 연산 종류별 처리량과 p50/p99/p999 지연 시간을 출력함
+//
+// 텍스트 기록은 한 줄에 연산 하나: insert K, find K, erase K, min, max, to_array N
+// (#으로 시작하는 줄과 빈 줄은 무시)
 
-}
\ No newline at end of file
+typedef struct
+{
+    unsigned char op;
+    key_t key;
+} trace_op_t;
+
+static const char *op_names[RBTREE_OP_KINDS] = {"insert", "find", "erase", "min", "max", "to_array"};
+
+// 연산 이름에 해당하는 rbtree_op_t, 없으면 -1
+static int op_parse(const char *name)
+{
+    for (int op = 0; op < RBTREE_OP_KINDS; op++)
+    {
+        if (strcmp(name, op_names[op]) == 0)
+        {
+            return op;
+        }
+    }
+
+    return -1;
+}
+
+// 키를 받는 연산인지 (min, max는 키가 없음)
+static int op_has_key(const int op)
+{
+    return op != RBTREE_OP_MIN && op != RBTREE_OP_MAX;
+}
+
+// 기록 배열 끝에 연산 하나를 추가, 실패하면 -1
+static int push_op(trace_op_t **ops, size_t *n, size_t *cap, const int op, const key_t key)
+{
+    if (*n == *cap)
+    {
+        size_t new_cap = *cap ? *cap * 2 : 1024;
+        trace_op_t *grown = (trace_op_t *)realloc(*ops, new_cap * sizeof(trace_op_t));
+        if (!grown)
+        {
+            return -1;
+        }
+        *ops = grown;
+        *cap = new_cap;
+    }
+
+    (*ops)[*n].op = op;
+    (*ops)[*n].key = key;
+    (*n)++;
+    return 0;
+}
+
+static int load_binary(const unsigned char *data, const size_t len, trace_op_t **ops, size_t *n, size_t *cap)
+{
+    if (len % RBTREE_TRACE_RECORD)
+    {
+        fprintf(stderr, "truncated record at the end of the trace\n");
+        return -1;
+    }
+
+    for (const unsigned char *rec = data; rec < data + len; rec += RBTREE_TRACE_RECORD)
+    {
+        if (rec[0] >= RBTREE_OP_KINDS)
+        {
+            fprintf(stderr, "record %zu: unknown op %u\n", *n, rec[0]);
+            return -1;
+        }
+        const uint32_t k = rec[1] | (uint32_t)rec[2] << 8 | (uint32_t)rec[3] << 16 | (uint32_t)rec[4] << 24;
+        if (push_op(ops, n, cap, rec[0], (key_t)k))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// data는 NUL로 끝나야 하고, 줄을 자르면서 내용이 바뀜
+static int load_text(char *data, trace_op_t **ops, size_t *n, size_t *cap)
+{
+    char *save = NULL;
+    size_t lineno = 0;
+
+    for (char *line = data; line; line = save)
+    {
+        save = strchr(line, '\n');
+        if (save)
+        {
+            *save++ = '\0';
+        }
+        lineno++;
+
+        char name[32];
+        long key = 0;
+        int fields = sscanf(line, "%31s %ld", name, &key);
+
+        if (fields < 1 || name[0] == '#')
+        {
+            continue;
+        }
+
+        int op = op_parse(name);
+        if (op < 0 || (op_has_key(op) && fields < 2) || key < INT_MIN || key > INT_MAX)
+        {
+            fprintf(stderr, "line %zu: cannot parse '%s'\n", lineno, line);
+            return -1;
+        }
+        if (push_op(ops, n, cap, op, (key_t)key))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// 파일 전체를 읽어 NUL로 끝나는 버퍼로 반환
+static char *read_all(FILE *in, size_t *len)
+{
+    size_t cap = 1 << 16;
+    char *data = (char *)malloc(cap);
+
+    *len = 0;
+    while (data)
+    {
+        *len += fread(data + *len, 1, cap - *len - 1, in);
+        if (*len < cap - 1)
+        {
+            break;
+        }
+        char *grown = (char *)realloc(data, cap * 2);
+        if (!grown)
+        {
+            free(data);
+            return NULL;
+        }
+        data = grown;
+        cap *= 2;
+    }
+
+    if (data)
+    {
+        data[*len] = '\0';
+    }
+    return data;
+}
+
+// 기록 파일 전체를 연산 배열로 올림 (파싱 시간이 재생 시간에 섞이지 않도록), 실패하면 -1
+// RBTREE_TRACE_MAGIC으로 시작하면 바이너리, 아니면 텍스트로 읽음
+static int load_trace(const char *path, trace_op_t **ops, size_t *n)
+{
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!in)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    size_t len;
+    char *data = read_all(in, &len);
+    int err = !data || ferror(in);
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    if (err)
+    {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(data);
+        return -1;
+    }
+
+    const size_t magic = sizeof(RBTREE_TRACE_MAGIC) - 1;
+    size_t cap = 0;
+
+    *ops = NULL;
+    *n = 0;
+    if (len >= magic && memcmp(data, RBTREE_TRACE_MAGIC, magic) == 0)
+    {
+        err = load_binary((const unsigned char *)data + magic, len - magic, ops, n, &cap);
+    }
+    else
+    {
+        err = load_text(data, ops, n, &cap);
+    }
+
+    free(data);
+    if (err)
+    {
+        free(*ops);
+        *ops = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// 정렬된 표본에서 nearest-rank 백분위수
+static uint64_t percentile(const uint64_t *sorted, const size_t n, const double q)
+{
+    size_t rank = (size_t)(q * n);
+    if (rank < q * n)
+    {
+        rank++; // 올림
+    }
+    return sorted[rank ? rank - 1 : 0];
+}
+
+typedef struct
+{
+    uint64_t *lat; // 연산별 지연 시간 (ns)
+    size_t samples;
+    size_t misses; // 없는 키를 찾거나 지우려 한 횟수
+} op_stats_t;
+
+// 기록을 t에 재생하며 연산별 지연 시간을 모음, 전체 재생 시간(ns)을 반환
+static uint64_t replay(rbtree *t, const trace_op_t *ops, const size_t n, op_stats_t *stats, key_t *buf)
+{
+    const uint64_t start = now_ns();
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const key_t key = ops[i].key;
+        node_t *p;
+        uint64_t t0, t1;
+
+        switch (ops[i].op)
+        {
+        case RBTREE_OP_INSERT:
+            t0 = now_ns();
+            rbtree_insert(t, key);
+            t1 = now_ns();
+            break;
+        case RBTREE_OP_FIND:
+            t0 = now_ns();
+            p = rbtree_find(t, key);
+            t1 = now_ns();
+            stats[RBTREE_OP_FIND].misses += p == NULL;
+            break;
+        case RBTREE_OP_ERASE:
+            // 기록된 것은 노드를 지운 호출이므로 노드 찾기는 재지 않음
+            p = rbtree_find(t, key);
+            if (!p)
+            {
+                stats[RBTREE_OP_ERASE].misses++;
+                continue;
+            }
+            t0 = now_ns();
+            rbtree_erase(t, p);
+            t1 = now_ns();
+            break;
+        case RBTREE_OP_MIN:
+            t0 = now_ns();
+            rbtree_min(t);
+            t1 = now_ns();
+            break;
+        case RBTREE_OP_MAX:
+            t0 = now_ns();
+            rbtree_max(t);
+            t1 = now_ns();
+            break;
+        default: // RBTREE_OP_TO_ARRAY
+            t0 = now_ns();
+            rbtree_to_array(t, buf, key > 0 ? key : 0);
+            t1 = now_ns();
+            break;
+        }
+
+        op_stats_t *s = &stats[ops[i].op];
+        s->lat[s->samples++] = t1 - t0;
+    }
+
+    return now_ns() - start;
+}
+
+static void report(op_stats_t *stats, const size_t n, const uint64_t wall)
+{
+    printf("%-9s %10s %8s %9s %9s %9s %9s\n", "op", "count", "miss", "Mops/s", "p50(ns)", "p99(ns)", "p999(ns)");
+
+    for (int op = 0; op < RBTREE_OP_KINDS; op++)
+    {
+        op_stats_t *s = &stats[op];
+        if (s->samples == 0 && s->misses == 0)
+        {
+            continue;
+        }
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < s->samples; i++)
+        {
+            total += s->lat[i];
+        }
+        qsort(s->lat, s->samples, sizeof(uint64_t), cmp_u64);
+
+        if (s->samples == 0)
+        {
+            printf("%-9s %10zu %8zu %9s %9s %9s %9s\n", op_names[op], s->samples, s->misses, "-", "-", "-", "-");
+            continue;
+        }
+        printf("%-9s %10zu %8zu %9.2f %9lu %9lu %9lu\n", op_names[op], s->samples, s->misses,
+               total ? s->samples * 1e3 / total : 0.0,
+               (unsigned long)percentile(s->lat, s->samples, 0.50),
+               (unsigned long)percentile(s->lat, s->samples, 0.99),
+               (unsigned long)percentile(s->lat, s->samples, 0.999));
+    }
+
+    // 연산별 수치는 연산만 잰 것이고, 전체 수치는 시계 읽기 비용까지 포함
+    printf("%-9s %10zu %8s %9.2f  (%.3f s wall)\n", "total", n, "", wall ? n * 1e3 / wall : 0.0, wall / 1e9);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-p] [-d] [-l ratio] [-f expected] trace\n"
+            "  -p           print the trace as text and exit\n"
+            "  -d           enable digest\n"
+            "  -l ratio     enable lazy erase with the given compact ratio\n"
+            "  -f expected  enable the find filter sized for expected keys\n"
+            "  trace        binary trace from rbtree_trace_start or a text trace, - for stdin\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    int print = 0, digest = 0;
+    double lazy = -1;
+    long filter = -1;
+    int c;
+
+    while ((c = getopt(argc, argv, "pdl:f:")) != -1)
+    {
+        switch (c)
+        {
+        case 'p':
+            print = 1;
+            break;
+        case 'd':
+            digest = 1;
+            break;
+        case 'l':
+            lazy = atof(optarg);
+            break;
+        case 'f':
+            filter = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    trace_op_t *ops;
+    size_t n;
+    if (load_trace(argv[optind], &ops, &n))
+    {
+        return 1;
+    }
+
+    if (print)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            if (op_has_key(ops[i].op))
+            {
+                printf("%s %d\n", op_names[ops[i].op], ops[i].key);
+            }
+            else
+            {
+                printf("%s\n", op_names[ops[i].op]);
+            }
+        }
+        free(ops);
+        return 0;
+    }
+
+    // 표본 버퍼와 to_array 버퍼는 재생 전에 한 번에 잡아 둠
+    size_t counts[RBTREE_OP_KINDS] = {0};
+    size_t max_array = 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        counts[ops[i].op]++;
+        if (ops[i].op == RBTREE_OP_TO_ARRAY && ops[i].key > 0 && (size_t)ops[i].key > max_array)
+        {
+            max_array = ops[i].key;
+        }
+    }
+
+    op_stats_t stats[RBTREE_OP_KINDS] = {{0}};
+    for (int op = 0; op < RBTREE_OP_KINDS; op++)
+    {
+        stats[op].lat = (uint64_t *)malloc((counts[op] ? counts[op] : 1) * sizeof(uint64_t));
+    }
+    key_t *buf = (key_t *)malloc(max_array * sizeof(key_t));
+
+    rbtree *t = new_rbtree();
+    if ((digest && rbtree_enable_digest(t)) ||
+        (lazy >= 0 && rbtree_enable_lazy_erase(t, lazy)) || (filter >= 0 && rbtree_enable_filter(t, filter)))
+    {
+        fprintf(stderr, "cannot enable the requested options\n");
+        return 1;
+    }
+
+    uint64_t wall = replay(t, ops, n, stats, buf);
+    report(stats, n, wall);
+
+    delete_rbtree(t);
+    for (int op = 0; op < RBTREE_OP_KINDS; op++)
+    {
+        free(stats[op].lat);
+    }
+    free(buf);
+    free(ops);
+    return 0;
+}
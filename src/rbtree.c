@@ -1,30 +1,255 @@
 #include "rbtree.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// 소형 모드에서 키를 배열로 들고 있는 최대 개수
+#define RBTREE_SMALL_MAX 8
+
+// 소형 모드 저장소 (RBTREE_SMALL_MODE로 빌드하면 모든 트리가 이 모드로 시작)
+// 노드 RBTREE_SMALL_MAX개가 트리 할당 안에 들어 있어 키가 적을 때는 키마다 malloc하지 않음
+// 배열 모드에서는 정렬된 keys 배열만으로 찾고(트리는 비어 있음), 넘치면 같은 노드들을 그대로
+// 트리에 연결해 승격하므로 노드 포인터가 바뀌지 않음. 트리 모드에서도 빈 칸은 노드 할당에 먼저 씀
+struct rbtree_small
+{
+    key_t keys[RBTREE_SMALL_MAX];          // 정렬된 키, 앞의 count개만 유효
+    unsigned char slots[RBTREE_SMALL_MAX]; // keys[i]를 가진 노드의 nodes 칸 번호
+    unsigned int used;                     // 쓰고 있는 nodes 칸의 비트
+    node_t nodes[RBTREE_SMALL_MAX];
+};
+
+// digest가 켜진 트리의 노드 배치
+// 서브트리 해시는 공개 node_t 뒤에 붙여, digest를 쓰지 않는 트리는 노드마다 8바이트를 내지 않음
+typedef struct
+{
+    node_t node; // 첫 멤버이므로 트리 코드는 그대로 node_t로 다룸
+    uint64_t hash;
+} digest_node_t;
 
-// 새로운 Red-Black 트리를 생성하고 초기화하는 함수
-// TODO: 필요한 경우 구조체 초기화
-rbtree *new_rbtree(void)
+// digest 노드의 서브트리 해시 (digest 트리의 노드와 센티넬에만 사용)
+static uint64_t *node_digest(const node_t *p)
+{
+    return &((digest_node_t *)p)->hash;
+}
+
+// 자주 쓰지 않는 기능들의 상태
+// 처음 rbtree_enable_*를 부를 때 할당하므로 기능을 켜지 않은 트리는 포인터 하나만 냄
+struct rbtree_features
+{
+    int digest;
+    int lazy_erase;
+    double compact_ratio;
+    node_t *sweep; // 툼스톤 정리를 이어갈 노드, NULL이면 처음부터
+    int reclaim;
+    struct rbtree_filter *filter;
+    struct rbtree_trace *trace;
+    struct rbtree_arena *arena; // huge page를 켜면 노드를 여기서 할당
+    digest_node_t nil;          // digest 트리의 센티넬 (해시 0을 읽을 수 있는 큰 배치)
+};
+
+// 기능을 하나도 켜지 않은 트리가 읽는 빈 상태
+static const struct rbtree_features no_features;
+
+// 읽기용 기능 상태 (없으면 모두 꺼진 상태)
+static const struct rbtree_features *features_of(const rbtree *t)
 {
-    rbtree *p = (rbtree *)calloc(1, sizeof(rbtree));
+    return t->features ? t->features : &no_features;
+}
 
-    if (!p)
+// 쓰기용 기능 상태, 없으면 할당 (실패하면 NULL)
+static struct rbtree_features *features_get(rbtree *t)
+{
+    if (!t->features)
+    {
+        t->features = (struct rbtree_features *)calloc(1, sizeof(struct rbtree_features));
+    }
+    return t->features;
+}
+
+// 트리 구조체와 센티넬 노드를 한 번에 할당하기 위한 묶음
+typedef struct
+{
+    rbtree tree; // 첫 멤버이므로 &block->tree == block
+    node_t nil;
+#ifdef RBTREE_SMALL_MODE
+    struct rbtree_small small; // 소형 모드 배열과 노드도 같은 할당에 둠
+#endif
+} rbtree_block;
+
+// 트리의 소형 모드 저장소 (소형 모드 빌드가 아니면 없음)
+static struct rbtree_small *small_of(const rbtree *t)
+{
+#ifdef RBTREE_SMALL_MODE
+    return &((rbtree_block *)t)->small;
+#else
+    return NULL;
+#endif
+}
+
+// p가 트리 할당 안의 소형 모드 노드인지 (free하면 안 되는 노드)
+static int small_owns(const rbtree *t, const node_t *p)
+{
+    const struct rbtree_small *s = small_of(t);
+    return s && p >= s->nodes && p < s->nodes + RBTREE_SMALL_MAX;
+}
+
+// 노드 아레나 (huge page)
+// 노드를 2MB 경계에 맞춘 큰 영역에서 잘라 쓰면 malloc 헤더 없이 빽빽하게 놓이고,
+// MADV_HUGEPAGE로 영역 하나가 TLB 항목 하나에 들어가 큰 트리의 무작위 탐색에서 TLB 미스가 줄어듦
+// 해제된 노드는 영역에 돌려주지 않고 자유 목록에 모아 다음 삽입에 재사용
+
+#define ARENA_REGION ((size_t)2 << 20)
+
+struct rbtree_arena
+{
+    void **regions;
+    size_t nregions, cap;
+    char *bump, *end;   // 현재 영역에서 아직 안 쓴 부분
+    node_t *free_list;  // left로 이어진 재사용 대기 노드
+    size_t free_nodes;
+    size_t node_size;   // 노드 하나의 바이트 수 (digest 트리는 digest_node_t)
+    int hugepages;      // madvise(MADV_HUGEPAGE)가 받아들여졌는지
+};
+
+// 2MB 경계에 맞춘 영역 하나를 새로 매핑
+static void *arena_map_region(struct rbtree_arena *a)
+{
+    // 두 배로 잡은 뒤 경계에 맞지 않는 앞뒤를 잘라냄
+    char *raw = (char *)mmap(NULL, 2 * ARENA_REGION, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
     {
-        // 메모리 할당 실패 처리
         return NULL;
     }
+    char *region = (char *)(((uintptr_t)raw + ARENA_REGION - 1) & ~(uintptr_t)(ARENA_REGION - 1));
+    if (region > raw)
+    {
+        munmap(raw, region - raw);
+    }
+    munmap(region + ARENA_REGION, raw + ARENA_REGION - region);
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(region, ARENA_REGION, MADV_HUGEPAGE) == 0)
+    {
+        a->hugepages = 1;
+    }
+#endif
+
+    return region;
+}
+
+static node_t *arena_alloc(struct rbtree_arena *a)
+{
+    node_t *p = a->free_list;
+    if (p)
+    {
+        a->free_list = p->left;
+        a->free_nodes--;
+        memset(p, 0, a->node_size); // calloc과 같게
+        return p;
+    }
+
+    if (a->end - a->bump < (ptrdiff_t)a->node_size)
+    {
+        if (a->nregions == a->cap)
+        {
+            size_t cap = a->cap ? a->cap * 2 : 16;
+            void **regions = (void **)realloc(a->regions, cap * sizeof(void *));
+            if (!regions)
+            {
+                return NULL;
+            }
+            a->regions = regions;
+            a->cap = cap;
+        }
+        char *region = (char *)arena_map_region(a);
+        if (!region)
+        {
+            return NULL;
+        }
+        a->regions[a->nregions++] = region;
+        a->bump = region;
+        a->end = region + ARENA_REGION;
+    }
+
+    // 새로 매핑한 익명 메모리는 0으로 채워져 있음
+    p = (node_t *)a->bump;
+    a->bump += a->node_size;
+    return p;
+}
+
+static void arena_free(struct rbtree_arena *a, node_t *p)
+{
+    p->left = a->free_list;
+    a->free_list = p;
+    a->free_nodes++;
+}
+
+static void arena_destroy(struct rbtree_arena *a)
+{
+    for (size_t i = 0; i < a->nregions; i++)
+    {
+        munmap(a->regions[i], ARENA_REGION);
+    }
+    free(a->regions);
+    free(a);
+}
+
+// 이후 노드를 huge page 아레나에서 할당하는 함수, 빈 트리에서만 켤 수 있음
+// 해제된 노드를 다른 스레드가 유예 후 free하는 동시 읽기 모드와는 함께 쓸 수 없음
+// huge page를 못 받아도 아레나 자체는 동작함 (rbtree_memory_usage의 hugepages로 확인)
+int rbtree_enable_hugepages(rbtree *t)
+{
+    if (features_of(t)->arena)
+    {
+        return 0;
+    }
+    if (t->count > 0 || features_of(t)->reclaim)
+    {
+        return -1;
+    }
 
-    // 센티넬(가드) 노드를 생성하고 검은색으로 설정
-    p->nil = (node_t *)calloc(1, sizeof(node_t));
+    struct rbtree_features *f = features_get(t);
+    if (!f)
+    {
+        return -1;
+    }
+    f->arena = (struct rbtree_arena *)calloc(1, sizeof(struct rbtree_arena));
+    if (!f->arena)
+    {
+        return -1;
+    }
+    f->arena->node_size = f->digest ? sizeof(digest_node_t) : sizeof(node_t);
+    return 0;
+}
 
-    if (!p->nil)
+// 새로운 Red-Black 트리를 생성하고 초기화하는 함수
+// 센티넬 노드는 트리 구조체와 같은 할당에 들어 있음
+rbtree *new_rbtree(void)
+{
+    rbtree_block *block = (rbtree_block *)calloc(1, sizeof(rbtree_block));
+
+    if (!block)
     {
         // 메모리 할당 실패 처리
-        free(p); // 이미 할당된 p 메모리 해제
         return NULL;
     }
 
+    // 센티넬(가드) 노드를 검은색으로 설정
+    rbtree *p = &block->tree;
+    p->nil = &block->nil;
     p->nil->color = RBTREE_BLACK;
     p->root = p->nil;
+    p->min_node = p->max_node = p->nil;
+#ifdef RBTREE_SMALL_MODE
+    p->small = p->small_array = 1;
+#endif
 
     return p;
 }
@@ -35,7 +260,10 @@ void delete_postorder(rbtree *t, node_t *currentNode)
     {
         delete_postorder(t, currentNode->left);
         delete_postorder(t, currentNode->right);
-        free(currentNode);
+        if (!small_owns(t, currentNode))
+        {
+            free(currentNode);
+        }
     }
 }
 
@@ -45,9 +273,325 @@ void delete_rbtree(rbtree *t)
 {
     // 모든 노드를 순회하면서 메모리 해제 필요
     // 후위 순회 방식을 사용해 자식 노드부터 메모리 해제 후, 루트 노드 해제
-    delete_postorder(t, t->root);
-    free(t->nil);
-    free(t);
+    // 읽기 중인 스레드는 없어야 하며, 아직 유예 중인 노드는 모두 회수한 뒤 해제
+    struct rbtree_features *f = t->features;
+    if (f && f->reclaim)
+    {
+        rbtree_synchronize();
+    }
+
+    if (f && f->trace)
+    {
+        rbtree_trace_stop(t);
+    }
+    // 아레나의 노드는 영역째 한 번에 돌려주므로 순회할 필요가 없음
+    // 배열 모드의 노드는 모두 트리 할당 안에 있음
+    if (f && f->arena)
+    {
+        arena_destroy(f->arena);
+    }
+    else if (!t->small_array)
+    {
+        delete_postorder(t, t->root);
+    }
+    if (f)
+    {
+        free(f->filter);
+        free(f);
+    }
+    free(t); // 센티넬 노드와 소형 모드 노드도 함께 해제됨
+}
+
+// Epoch 기반 메모리 회수 (EBR)
+// 읽기 스레드는 rbtree_read_enter/exit 사이에서만 노드를 만지고,
+// 삭제된 노드는 바로 free하지 않고 삭제한 스레드의 retire 목록에 넣어 둠
+// 전역 epoch는 읽기 중인 모든 스레드가 현재 epoch를 본 뒤에만 1씩 증가하므로
+// epoch e에 retire된 노드는 전역 epoch가 e + 2가 되면 아무도 참조하지 않음
+
+#define EBR_COLLECT_INTERVAL 64
+
+typedef struct
+{
+    void *ptr;
+    uint64_t epoch;
+} ebr_retired;
+
+typedef struct ebr_record
+{
+    _Atomic uint64_t state; // 읽기 중이면 (epoch << 1) | 1, 아니면 0
+    atomic_int in_use;      // 스레드가 점유 중인지
+    int depth;              // read_enter 중첩 깊이
+    pthread_mutex_t lock;   // retire 목록 보호 (평소엔 주인 스레드만 잡음)
+    ebr_retired *items;     // retire된 순서 = epoch 오름차순
+    size_t head, len, cap;
+    struct ebr_record *next;
+} ebr_record;
+
+static _Atomic uint64_t ebr_global_epoch = 0;
+static ebr_record *_Atomic ebr_records = NULL; // 레코드는 해제하지 않고 재사용
+static _Thread_local ebr_record *ebr_self_record = NULL;
+
+// 현재 스레드의 레코드를 얻는 함수 (비어 있는 레코드를 재사용하거나 새로 만들어 목록에 추가)
+static ebr_record *ebr_self(void)
+{
+    if (ebr_self_record)
+    {
+        return ebr_self_record;
+    }
+
+    for (ebr_record *r = atomic_load(&ebr_records); r; r = r->next)
+    {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&r->in_use, &expected, 1))
+        {
+            return ebr_self_record = r;
+        }
+    }
+
+    ebr_record *r = (ebr_record *)calloc(1, sizeof(ebr_record));
+    if (!r)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    atomic_init(&r->in_use, 1);
+
+    ebr_record *head = atomic_load(&ebr_records);
+    do
+    {
+        r->next = head;
+    } while (!atomic_compare_exchange_weak(&ebr_records, &head, r));
+
+    return ebr_self_record = r;
+}
+
+// 읽기 중인 모든 스레드가 현재 epoch에 있으면 전역 epoch를 한 단계 올림
+static void ebr_try_advance(void)
+{
+    uint64_t epoch = atomic_load(&ebr_global_epoch);
+
+    for (ebr_record *r = atomic_load(&ebr_records); r; r = r->next)
+    {
+        uint64_t state = atomic_load(&r->state);
+        if ((state & 1) && (state >> 1) != epoch)
+        {
+            return; // 이전 epoch에서 읽고 있는 스레드가 있음
+        }
+    }
+
+    atomic_compare_exchange_strong(&ebr_global_epoch, &epoch, epoch + 1);
+}
+
+// 유예 기간이 지난 노드들을 해제 (r->lock을 잡은 상태에서 호출)
+static void ebr_collect(ebr_record *r)
+{
+    uint64_t epoch = atomic_load(&ebr_global_epoch);
+
+    while (r->head < r->len && r->items[r->head].epoch + 2 <= epoch)
+    {
+        free(r->items[r->head++].ptr);
+    }
+
+    if (r->head == r->len)
+    {
+        r->head = r->len = 0;
+    }
+}
+
+// 노드를 바로 free하지 않고 현재 스레드의 retire 목록에 넣는 함수
+static void ebr_retire(void *ptr)
+{
+    ebr_record *r = ebr_self();
+
+    if (!r)
+    {
+        // 레코드를 만들 수 없으면 안전하게 회수할 방법이 없으므로 유예 없이 기다렸다가 해제
+        rbtree_synchronize();
+        free(ptr);
+        return;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    if (r->len == r->cap)
+    {
+        // 앞쪽의 이미 해제된 칸을 당겨 쓰고, 그래도 모자라면 늘림
+        if (r->head > 0)
+        {
+            for (size_t i = r->head; i < r->len; i++)
+            {
+                r->items[i - r->head] = r->items[i];
+            }
+            r->len -= r->head;
+            r->head = 0;
+        }
+        if (r->len == r->cap)
+        {
+            size_t cap = r->cap ? r->cap * 2 : EBR_COLLECT_INTERVAL;
+            ebr_retired *items = (ebr_retired *)realloc(r->items, cap * sizeof(ebr_retired));
+            if (!items)
+            {
+                pthread_mutex_unlock(&r->lock);
+                rbtree_synchronize();
+                free(ptr);
+                return;
+            }
+            r->items = items;
+            r->cap = cap;
+        }
+    }
+    r->items[r->len].ptr = ptr;
+    r->items[r->len].epoch = atomic_load(&ebr_global_epoch);
+    r->len++;
+
+    if ((r->len - r->head) % EBR_COLLECT_INTERVAL == 0)
+    {
+        ebr_try_advance();
+        ebr_collect(r);
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+// 읽기 구간 시작: 이 구간에서 얻은 노드 포인터는 rbtree_read_exit 전까지 해제되지 않음
+void rbtree_read_enter(void)
+{
+    ebr_record *r = ebr_self();
+
+    if (!r || r->depth++ > 0)
+    {
+        return;
+    }
+
+    atomic_store(&r->state, (atomic_load(&ebr_global_epoch) << 1) | 1);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+// 읽기 구간 끝
+void rbtree_read_exit(void)
+{
+    ebr_record *r = ebr_self_record;
+
+    if (!r || --r->depth > 0)
+    {
+        return;
+    }
+
+    atomic_store_explicit(&r->state, 0, memory_order_release);
+}
+
+// 지금까지 retire된 노드를 모두 안전하게 해제하는 함수
+// 모든 스레드의 읽기 구간이 한 번씩 끝날 때까지 기다리므로 읽기 구간 안에서 부르면 안 됨
+void rbtree_synchronize(void)
+{
+    uint64_t target = atomic_load(&ebr_global_epoch) + 2;
+
+    while (atomic_load(&ebr_global_epoch) < target)
+    {
+        ebr_try_advance();
+        if (atomic_load(&ebr_global_epoch) < target)
+        {
+            sched_yield();
+        }
+    }
+
+    for (ebr_record *r = atomic_load(&ebr_records); r; r = r->next)
+    {
+        pthread_mutex_lock(&r->lock);
+        ebr_collect(r);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+// 스레드가 끝나기 전에 부르면 레코드를 다른 스레드가 재사용할 수 있게 반납
+// 아직 유예 중인 노드는 레코드에 남아 다음 사용자나 rbtree_synchronize가 해제
+void rbtree_thread_exit(void)
+{
+    ebr_record *r = ebr_self_record;
+
+    if (!r)
+    {
+        return;
+    }
+
+    r->depth = 0;
+    atomic_store(&r->state, 0);
+    atomic_store(&r->in_use, 0);
+    ebr_self_record = NULL;
+}
+
+static void small_promote(rbtree *t);
+
+// 동시 읽기를 허용하는 트리로 설정하는 함수
+// 쓰기(insert/erase/compact)는 여전히 한 번에 한 스레드만 해야 함
+// 소형 모드 배열은 제자리에서 밀고 당기므로 리더와 함께 쓸 수 없어, 트리로 승격한 뒤 소형 모드를 끔
+int rbtree_enable_reclamation(rbtree *t)
+{
+    struct rbtree_features *f = features_get(t);
+    if (!f || f->arena)
+    {
+        return -1;
+    }
+
+    if (t->small_array)
+    {
+        small_promote(t);
+    }
+    t->small = 0;
+    f->reclaim = 1;
+    return 0;
+}
+
+// 트리에서 떨어진 노드를 해제하는 함수 (동시 읽기 모드면 유예 후 해제)
+// 소형 모드 노드는 칸만 비움. 회수 모드에서는 소형 모드가 꺼져 빈 칸을 다시 쓰지 않으므로
+// 리더가 아직 보고 있어도 트리가 지워질 때까지 그대로 읽을 수 있음
+static void rbtree_free_node(rbtree *t, node_t *p)
+{
+    if (small_owns(t, p))
+    {
+        small_of(t)->used &= ~(1u << (p - small_of(t)->nodes));
+    }
+    else if (features_of(t)->reclaim)
+    {
+        ebr_retire(p);
+    }
+    else if (t->features && t->features->arena)
+    {
+        arena_free(t->features->arena, p);
+    }
+    else
+    {
+        free(p);
+    }
+}
+
+// 키 하나의 해시 값 (splitmix64 finalizer)
+static uint64_t key_hash(const key_t key)
+{
+    uint64_t z = (uint64_t)(uint32_t)key + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// 노드 자신의 해시 (툼스톤은 트리에 없는 것으로 취급)
+static uint64_t node_hash(const node_t *x)
+{
+    return x->tombstone ? 0 : key_hash(x->key);
+}
+
+// 서브트리 해시 = 서브트리 안 모든 키 해시의 합
+// 덧셈은 순서와 무관하므로 회전 이력이 달라도 같은 키 집합이면 같은 값이 나옴
+static void rbtree_update_hash(node_t *x)
+{
+    *node_digest(x) = *node_digest(x->left) + *node_digest(x->right) + node_hash(x);
+}
+
+// x부터 루트까지 올라가며 서브트리 해시를 다시 계산
+static void rbtree_refresh_path(rbtree *t, node_t *x)
+{
+    for (; x != t->nil; x = x->parent)
+    {
+        rbtree_update_hash(x);
+    }
 }
 
 // 왼쪽으로 회전하는 함수
@@ -80,6 +624,13 @@ void rbtree_left_rotate(rbtree *t, node_t *x)
     }
     y->left = x; // x를 y의 왼쪽으로 놓기
     x->parent = y;
+
+    // y가 x 자리를 차지하므로 y는 기존 x의 해시를, x는 새 자식들로 다시 계산
+    if (features_of(t)->digest)
+    {
+        *node_digest(y) = *node_digest(x);
+        rbtree_update_hash(x);
+    }
 }
 
 // 오른쪽으로 회전하는 함수
@@ -113,6 +664,12 @@ void rbtree_right_rotate(rbtree *t, node_t *x)
     }
     y->right = x;
     x->parent = y;
+
+    if (features_of(t)->digest)
+    {
+        *node_digest(y) = *node_digest(x);
+        rbtree_update_hash(x);
+    }
 }
 
 void rbtree_insert_fixup(rbtree *t, node_t *newNode)
@@ -190,341 +747,2962 @@ void rbtree_insert_fixup(rbtree *t, node_t *newNode)
     t->root->color = RBTREE_BLACK;
 }
 
-// 트리에 새로운 키를 가진 노드를 삽입하는 함수
-node_t *rbtree_insert(rbtree *t, const key_t key)
+// key보다 작은(strict가 0이면 이하인) 키의 개수 = 배열에서 key가 들어갈 위치
+// 앞의 count개만 세되 분기 없이 항상 RBTREE_SMALL_MAX칸 전체를 훑어 벡터화되게 함
+// (빈 칸 표시용 키 값을 두지 않으므로 INT_MAX도 보통 키처럼 들어감)
+static int small_rank(const rbtree *t, const key_t key, const int strict)
 {
-    // 일반 이진 탐색 트리처럼 노드 삽입
-    node_t *currentNode = t->root; // 루트 노드
-    node_t *parentNode = t->nil;   // 추후 부모가 될 노드
+    const key_t *keys = small_of(t)->keys;
+    const int n = t->count;
+    int rank = 0;
 
-    // 루트 노드부터 내려가며 새로 노드가 삽입될 위치 찾기
-    while (currentNode != t->nil)
+    for (int i = 0; i < RBTREE_SMALL_MAX; i++)
     {
-        parentNode = currentNode;
+        rank += (i < n) & (strict ? keys[i] < key : keys[i] <= key);
+    }
 
-        if (key < currentNode->key)
-        {
-            currentNode = currentNode->left;
-        }
-        else
+    return rank;
+}
+
+// 배열 i번째 키를 가진 노드
+static node_t *small_node(const rbtree *t, const int i)
+{
+    struct rbtree_small *s = small_of(t);
+    return &s->nodes[s->slots[i]];
+}
+
+// 배열에서 노드 p의 위치
+static int small_index(const rbtree *t, const node_t *p)
+{
+    const struct rbtree_small *s = small_of(t);
+    const int slot = p - s->nodes;
+
+    for (int i = 0; i < (int)t->count; i++)
+    {
+        if (s->slots[i] == slot)
         {
-            currentNode = currentNode->right;
+            return i;
         }
     }
 
-    // 받은 key 값을 가진 노드 추가
-    node_t *newNode = (node_t *)calloc(1, sizeof(node_t));
-    if (!newNode)
-    {
-        // 메모리 할당 실패 처리
-        return NULL;
-    }
+    return -1;
+}
 
-    // 삽입될 노드의 값 설정
+// 배열 모드에서 양 끝 노드 캐시를 맞춤
+static void small_sync_ends(rbtree *t)
+{
+    t->min_node = t->count ? small_node(t, 0) : t->nil;
+    t->max_node = t->count ? small_node(t, t->count - 1) : t->nil;
+}
+
+// 배열 모드에서 소형 모드 노드 p를 key 순서 위치에 넣음 (같은 키는 기존 키 뒤에)
+static void small_place(rbtree *t, node_t *p, const key_t key)
+{
+    struct rbtree_small *s = small_of(t);
+    const int pos = small_rank(t, key, 0);
+
+    for (int i = t->count; i > pos; i--)
+    {
+        s->keys[i] = s->keys[i - 1];
+        s->slots[i] = s->slots[i - 1];
+    }
+    s->keys[pos] = key;
+    s->slots[pos] = p - s->nodes;
+    p->key = key;
+    t->count++;
+    small_sync_ends(t);
+}
+
+// 배열 모드에서 노드를 배열에서 빼냄 (노드 해제는 하지 않음)
+static void small_take(rbtree *t, const node_t *p)
+{
+    struct rbtree_small *s = small_of(t);
+
+    for (int i = small_index(t, p); i < (int)t->count - 1; i++)
+    {
+        s->keys[i] = s->keys[i + 1];
+        s->slots[i] = s->slots[i + 1];
+    }
+    t->count--;
+    small_sync_ends(t);
+}
+
+// 중위 순회 기준 첫 노드 (빈 트리면 nil, 툼스톤 포함), 캐시해 둔 값이라 O(1)
+static node_t *rbtree_first(const rbtree *t)
+{
+    return t->min_node;
+}
+
+// 링크를 정확히 한 번만 읽음
+// 회수 모드에서 리더는 쓰기 스레드의 회전과 겹쳐 돌 수 있어서, 같은 링크를 두 번 읽으면
+// nil 검사를 통과한 값과 실제로 따라가는 값이 달라져 nil을 역참조할 수 있음
+static inline node_t *read_link(node_t *const *link)
+{
+    return *(node_t *const volatile *)link;
+}
+
+// 중위 순회 기준 다음 노드를 찾는 함수
+// 부모 포인터를 따라 올라가므로 스택이나 추가 메모리가 필요 없음
+static node_t *rbtree_successor(const rbtree *t, const node_t *p)
+{
+    if (t->small_array)
+    {
+        const int i = small_index(t, p) + 1;
+        return i < (int)t->count ? small_node(t, i) : t->nil;
+    }
+
+    node_t *next = read_link(&p->right);
+    if (next != t->nil)
+    {
+        p = next;
+        while ((next = read_link(&p->left)) != t->nil)
+        {
+            p = next;
+        }
+        return (node_t *)p;
+    }
+
+    node_t *parent = read_link(&p->parent);
+    while (parent != t->nil && p == read_link(&parent->right))
+    {
+        p = parent;
+        parent = read_link(&parent->parent);
+    }
+
+    return parent;
+}
+
+// key 이상인 첫 노드 (없으면 nil, 툼스톤 포함)
+static node_t *rbtree_lower_bound(const rbtree *t, const key_t key)
+{
+    if (t->small_array)
+    {
+        const int i = small_rank(t, key, 1);
+        return i < (int)t->count ? small_node(t, i) : t->nil;
+    }
+
+    node_t *p = t->root;
+    node_t *found = t->nil;
+
+    while (p != t->nil)
+    {
+        if (p->key >= key)
+        {
+            found = p;
+            p = p->left;
+        }
+        else
+        {
+            p = p->right;
+        }
+    }
+
+    return found;
+}
+
+// 중위 순회 기준 마지막 노드 (빈 트리면 nil, 툼스톤 포함)
+static node_t *rbtree_last(const rbtree *t)
+{
+    return t->max_node;
+}
+
+// 중위 순회 기준 이전 노드 (rbtree_successor와 대칭)
+static node_t *rbtree_predecessor(const rbtree *t, const node_t *p)
+{
+    if (t->small_array)
+    {
+        const int i = small_index(t, p) - 1;
+        return i >= 0 ? small_node(t, i) : t->nil;
+    }
+
+    node_t *next = read_link(&p->left);
+    if (next != t->nil)
+    {
+        p = next;
+        while ((next = read_link(&p->right)) != t->nil)
+        {
+            p = next;
+        }
+        return (node_t *)p;
+    }
+
+    node_t *parent = read_link(&p->parent);
+    while (parent != t->nil && p == read_link(&parent->left))
+    {
+        p = parent;
+        parent = read_link(&parent->parent);
+    }
+
+    return parent;
+}
+
+// p부터 툼스톤이 아닌 노드가 나올 때까지 앞으로 이동 (없으면 nil)
+static node_t *skip_dead_forward(const rbtree *t, node_t *p)
+{
+    while (p != t->nil && p->tombstone)
+    {
+        p = rbtree_successor(t, p);
+    }
+
+    return p;
+}
+
+// p부터 툼스톤이 아닌 노드가 나올 때까지 뒤로 이동 (없으면 nil)
+static node_t *skip_dead_backward(const rbtree *t, node_t *p)
+{
+    while (p != t->nil && p->tombstone)
+    {
+        p = rbtree_predecessor(t, p);
+    }
+
+    return p;
+}
+
+// 살아있는 노드 기준 다음 노드 (없으면 nil)
+static node_t *live_next(const rbtree *t, const node_t *p)
+{
+    return skip_dead_forward(t, rbtree_successor(t, p));
+}
+
+// 근사 멤버십 필터 (counting blocked Bloom filter)
+// 64바이트(캐시 라인 하나) 블록마다 4비트 카운터 128개를 두고, 키 하나는 한 블록 안의
+// 카운터 FILTER_PROBES개에만 표시하므로 없는 키는 캐시 라인 하나만 보고 거절할 수 있음
+// 카운터라서 erase 때 다시 빼 줄 수 있고, 15에 도달한 카운터는 더 이상 건드리지 않음
+
+#define FILTER_BLOCK_BYTES 64
+#define FILTER_PROBES 6
+#define FILTER_KEYS_PER_BLOCK 8 // 키당 카운터 16개 정도, 오탐률 0.1% 안팎
+
+struct rbtree_filter
+{
+    size_t mask;            // 블록 수 - 1 (블록 수는 2의 거듭제곱)
+    size_t capacity;        // 이 크기로 감당할 키 수, 넘으면 다시 만듦
+    // 통계는 const 트리에서 여러 읽기 스레드가 함께 세므로 relaxed 원자 연산으로 더함
+    atomic_size_t queries;         // rbtree_find에서 필터를 확인한 횟수
+    atomic_size_t negatives;       // 필터가 바로 거절한 횟수
+    atomic_size_t false_positives; // 필터는 통과했지만 트리에 없던 횟수
+    uint8_t (*blocks)[FILTER_BLOCK_BYTES]; // 헤더 바로 뒤, 64바이트 경계에서 시작
+};
+
+static inline void filter_count(atomic_size_t *counter)
+{
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+// 필터 하나를 만드는 함수 (블록이 캐시 라인에 맞도록 64바이트 정렬)
+static struct rbtree_filter *filter_new(size_t capacity)
+{
+    size_t nblocks = 1;
+    while (nblocks * FILTER_KEYS_PER_BLOCK < capacity)
+    {
+        nblocks <<= 1;
+    }
+
+    size_t header = (sizeof(struct rbtree_filter) + FILTER_BLOCK_BYTES - 1) / FILTER_BLOCK_BYTES * FILTER_BLOCK_BYTES;
+    size_t bytes = header + nblocks * FILTER_BLOCK_BYTES;
+    struct rbtree_filter *f = (struct rbtree_filter *)aligned_alloc(FILTER_BLOCK_BYTES, bytes);
+    if (!f)
+    {
+        return NULL;
+    }
+    memset(f, 0, bytes);
+
+    // 헤더와 블록을 한 번에 할당해 free 한 번(또는 retire 한 번)으로 해제
+    f->blocks = (uint8_t (*)[FILTER_BLOCK_BYTES])((char *)f + header);
+    f->mask = nblocks - 1;
+    f->capacity = nblocks * FILTER_KEYS_PER_BLOCK;
+    return f;
+}
+
+// 키가 표시될 블록을 고르고, 블록 안 카운터 위치들을 pos에 채움
+// 위치 6개는 블록을 고른 해시와 다른 해시에서 겹치지 않는 7비트씩 잘라 서로 독립이 되게 함
+static uint8_t *filter_probe(const struct rbtree_filter *f, const key_t key, unsigned *pos)
+{
+    uint64_t h = key_hash(~key);
+
+    for (int i = 0; i < FILTER_PROBES; i++)
+    {
+        pos[i] = h & 127; // 블록 안 카운터 128개 중 하나
+        h >>= 7;
+    }
+
+    return (uint8_t *)f->blocks[(key_hash(key) >> 32) & f->mask];
+}
+
+static unsigned filter_get(const uint8_t *block, const unsigned i)
+{
+    return (block[i >> 1] >> ((i & 1) << 2)) & 0xf;
+}
+
+static void filter_add(struct rbtree_filter *f, const key_t key)
+{
+    unsigned pos[FILTER_PROBES];
+    uint8_t *block = filter_probe(f, key, pos);
+
+    for (int i = 0; i < FILTER_PROBES; i++)
+    {
+        if (filter_get(block, pos[i]) < 15)
+        {
+            block[pos[i] >> 1] += 1 << ((pos[i] & 1) << 2);
+        }
+    }
+}
+
+static void filter_remove(struct rbtree_filter *f, const key_t key)
+{
+    unsigned pos[FILTER_PROBES];
+    uint8_t *block = filter_probe(f, key, pos);
+
+    for (int i = 0; i < FILTER_PROBES; i++)
+    {
+        unsigned c = filter_get(block, pos[i]);
+        // 포화된 카운터는 몇 번 더해졌는지 모르므로 그대로 둠
+        if (c > 0 && c < 15)
+        {
+            block[pos[i] >> 1] -= 1 << ((pos[i] & 1) << 2);
+        }
+    }
+}
+
+// 키가 있을 수도 있으면 1, 확실히 없으면 0
+static int filter_may_contain(const struct rbtree_filter *f, const key_t key)
+{
+    unsigned pos[FILTER_PROBES];
+    const uint8_t *block = filter_probe(f, key, pos);
+
+    for (int i = 0; i < FILTER_PROBES; i++)
+    {
+        if (filter_get(block, pos[i]) == 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// 트리의 모든 노드로 capacity 크기의 필터를 새로 만들어 교체
+static int filter_rebuild(rbtree *t, size_t capacity)
+{
+    struct rbtree_features *features = features_get(t);
+    struct rbtree_filter *f = features ? filter_new(capacity) : NULL;
+    if (!f)
+    {
+        return -1;
+    }
+
+    // 배열 모드의 키는 필터 없이 찾으므로 트리에 있는 노드만 넣음
+    for (node_t *p = rbtree_first(t); p != t->nil && !t->small_array; p = rbtree_successor(t, p))
+    {
+        filter_add(f, p->key);
+    }
+
+    struct rbtree_filter *old = features->filter;
+    if (old)
+    {
+        // 복사 이후 이전 필터에 더해지는 몇 건은 잃어도 됨
+        atomic_init(&f->queries, atomic_load_explicit(&old->queries, memory_order_relaxed));
+        atomic_init(&f->negatives, atomic_load_explicit(&old->negatives, memory_order_relaxed));
+        atomic_init(&f->false_positives, atomic_load_explicit(&old->false_positives, memory_order_relaxed));
+    }
+
+    // 읽기 스레드가 다 채워진 필터만 보도록 채운 뒤에 교체하고, 이전 필터는 유예 후 해제
+    if (features->reclaim)
+    {
+        atomic_thread_fence(memory_order_release);
+    }
+    features->filter = f;
+    if (old)
+    {
+        if (features->reclaim)
+        {
+            ebr_retire(old);
+        }
+        else
+        {
+            free(old);
+        }
+    }
+
+    return 0;
+}
+
+// rbtree_find 앞에 필터를 붙이는 함수, expected는 예상 키 수 (작으면 자라면서 다시 만듦)
+// 소형 모드의 배열에 있는 키는 필터에 넣지 않고, 트리로 승격될 때 들어감
+int rbtree_enable_filter(rbtree *t, size_t expected)
+{
+    if (expected < t->count)
+    {
+        expected = t->count;
+    }
+
+    return filter_rebuild(t, expected);
+}
+
+// 필터 통계를 채우는 함수, 필터가 없으면 -1
+int rbtree_filter_stats(const rbtree *t, filter_stats_t *stats)
+{
+    const struct rbtree_filter *f = features_of(t)->filter;
+
+    if (!f)
+    {
+        return -1;
+    }
+
+    stats->queries = atomic_load_explicit(&f->queries, memory_order_relaxed);
+    stats->negatives = atomic_load_explicit(&f->negatives, memory_order_relaxed);
+    stats->false_positives = atomic_load_explicit(&f->false_positives, memory_order_relaxed);
+    stats->bytes = (f->mask + 1) * FILTER_BLOCK_BYTES;
+    // 없는 키를 물어본 경우 중 필터를 통과해 버린 비율
+    stats->fp_rate = stats->negatives + stats->false_positives
+                         ? (double)stats->false_positives / (stats->negatives + stats->false_positives)
+                         : 0;
+    return 0;
+}
+
+// 호출 기록 (trace)
+// 공개 연산 호출을 파일에 그대로 남겨 src/driver로 오프라인에서 재생할 수 있게 함
+// 파일은 RBTREE_TRACE_MAGIC 다음에 레코드가 이어지는 형식이고,
+// 레코드는 연산 1바이트 + 키 4바이트(little-endian)
+// pop_min/pop_max는 erase로, update_key는 erase + insert로 남겨 재생 후 키 집합이 같게 함
+struct rbtree_trace
+{
+    FILE *out;
+};
+
+static void trace_write(struct rbtree_trace *trace, const rbtree_op_t op, const key_t key)
+{
+    const uint32_t k = (uint32_t)key;
+    const unsigned char rec[RBTREE_TRACE_RECORD] = {op, k, k >> 8, k >> 16, k >> 24};
+
+    // 한 번의 fwrite는 스트림 락 안에서 처리되므로 읽기 스레드의 find와 섞여도 레코드가 쪼개지지 않음
+    fwrite(rec, sizeof(rec), 1, trace->out);
+}
+
+// 기록이 켜져 있을 때만 레코드를 남김, 꺼져 있으면 분기 하나
+static inline void trace_op(const rbtree *t, const rbtree_op_t op, const key_t key)
+{
+    struct rbtree_trace *trace = features_of(t)->trace;
+    if (trace)
+    {
+        trace_write(trace, op, key);
+    }
+}
+
+// path에 호출 기록을 시작하는 함수, 이미 기록 중이거나 파일을 열 수 없으면 -1
+// 재생은 빈 트리에서 시작하므로 지금 들어 있는 키를 insert 레코드로 먼저 남김
+int rbtree_trace_start(rbtree *t, const char *path)
+{
+    struct rbtree_features *f = features_get(t);
+    if (!f || f->trace)
+    {
+        return -1;
+    }
+
+    struct rbtree_trace *trace = (struct rbtree_trace *)malloc(sizeof(struct rbtree_trace));
+    if (!trace)
+    {
+        return -1;
+    }
+    trace->out = fopen(path, "wb");
+    if (!trace->out)
+    {
+        free(trace);
+        return -1;
+    }
+
+    fwrite(RBTREE_TRACE_MAGIC, sizeof(RBTREE_TRACE_MAGIC) - 1, 1, trace->out);
+    for (node_t *p = skip_dead_forward(t, rbtree_first(t)); p != t->nil; p = live_next(t, p))
+    {
+        trace_write(trace, RBTREE_OP_INSERT, p->key);
+    }
+
+    f->trace = trace;
+    return 0;
+}
+
+// 기록을 끝내고 파일을 닫는 함수, 기록 중이 아니었거나 쓰기에 실패했으면 -1
+int rbtree_trace_stop(rbtree *t)
+{
+    struct rbtree_trace *trace = features_of(t)->trace;
+
+    if (!trace)
+    {
+        return -1;
+    }
+
+    t->features->trace = NULL;
+    const int failed = ferror(trace->out);
+    const int closed = fclose(trace->out);
+    free(trace);
+
+    return failed || closed ? -1 : 0;
+}
+
+// 준비된 노드를 parentNode의 자식으로 연결하고 균형을 맞추는 함수
+// parentNode는 key 순서상 newNode가 들어갈 빈 자리(nil 자식)를 가진 노드여야 함
+static void rbtree_link(rbtree *t, node_t *parentNode, node_t *newNode)
+{
+    // 삽입될 노드의 값 설정
+    // 동시 읽기 스레드가 볼 수 있도록 트리에 연결하기 전에 모든 필드를 채움
     newNode->parent = parentNode;
-    newNode->key = key;
+    newNode->color = RBTREE_RED; // 삽입된 노드의 색상을 빨간색으로 설정
+    newNode->left = t->nil;
+    newNode->right = t->nil;
+
+    // 필터는 트리에 연결하기 전에 갱신해야 읽기 스레드가 새 키를 놓치지 않음
+    const struct rbtree_features *f = features_of(t);
+    if (f->filter)
+    {
+        if (t->count >= f->filter->capacity * 2)
+        {
+            filter_rebuild(t, t->count * 2); // 실패하면 오탐률만 올라감
+        }
+        filter_add(f->filter, newNode->key);
+    }
+
+    if (f->reclaim)
+    {
+        atomic_thread_fence(memory_order_release);
+    }
 
     // 노드 삽입
     if (parentNode == t->nil)
     {
         t->root = newNode;
+        t->min_node = t->max_node = newNode;
     }
     else if (newNode->key < parentNode->key)
     {
         parentNode->left = newNode;
+        // 새 최솟값은 항상 기존 최솟값의 왼쪽 자식으로 들어옴
+        if (parentNode == t->min_node)
+        {
+            t->min_node = newNode;
+        }
     }
     else
     {
         parentNode->right = newNode;
+        if (parentNode == t->max_node)
+        {
+            t->max_node = newNode;
+        }
     }
 
-    // 삽입된 노드의 색상을 빨간색으로 설정
-    newNode->color = RBTREE_RED;
-    newNode->left = t->nil;
-    newNode->right = t->nil;
+    t->count++;
+
+    // 새 노드부터 루트까지의 경로에 새 키의 해시를 반영
+    if (f->digest)
+    {
+        rbtree_refresh_path(t, newNode);
+    }
 
     // Red-Black 트리의 속성을 유지하기 위해 삽입 후 조정 작업 필요
     rbtree_insert_fixup(t, newNode);
-    return t->root;
 }
 
-// 트리에서 주어진 키를 가진 노드를 찾는 함수
-// TODO: 찾기 구현
-node_t *rbtree_find(const rbtree *t, const key_t key) // t : 트리, key : 검색 노드 키
+// start 서브트리에서 내려가 newNode->key가 들어갈 자리를 찾아 연결하는 함수
+// start는 루트이거나, 서브트리 키 범위에 newNode->key가 들어가는 노드여야 함
+static void rbtree_insert_node(rbtree *t, node_t *start, node_t *newNode)
 {
-    node_t *node = NULL; // 검색할 노드를 저장할 변수
-    node = t->root; // 루트 노드부터 검색 시작
-    // 1. 루트 노드부터 시작하여 키 비교를 통해 왼쪽 또는 오른쪽 자식으로 이동
-    while (node != t->nil && node->key != key)
+    // 일반 이진 탐색 트리처럼 노드 삽입
+    node_t *currentNode = start;   // 탐색 시작 노드
+    node_t *parentNode = t->nil;   // 추후 부모가 될 노드
+
+    // 시작 노드부터 내려가며 새로 노드가 삽입될 위치 찾기
+    while (currentNode != t->nil)
     {
-        if (key < node->key)
+        parentNode = currentNode;
+
+        if (newNode->key < currentNode->key)
         {
-            node = node->left; // 키가 현재 노드의 키보다 작으면 왼쪽 자식으로 이동
+            currentNode = currentNode->left;
         }
         else
         {
-            node = node->right; // 키가 현재 노드의 키보다 크면 오른쪽 자식으로 이동
+            currentNode = currentNode->right;
         }
     }
-    // 2. 일치하는 키를 찾으면 해당 노드 반환, 찾지 못하면 NULL 반환
-    if (node == t->nil)
+
+    rbtree_link(t, parentNode, newNode);
+}
+
+// finger 삽입 때 hint에서 올라갈 최대 단계 수
+#define RBTREE_FINGER_CLIMB 16
+
+// hint 노드 근처에서 key가 들어갈 서브트리의 루트를 찾는 함수 (finger search)
+// hint에서 필요한 만큼만 올라가며, 서브트리의 키 범위는 가장 가까운
+// "왼쪽 자식으로 내려온" 조상(상한)과 "오른쪽 자식으로 내려온" 조상(하한)이 정함
+// 너무 멀리 올라가야 하면 루트부터 내려가는 편이 빠르므로 루트를 반환
+static node_t *rbtree_finger_start(const rbtree *t, const node_t *hint, const key_t key)
+{
+#ifdef RBTREE_NO_FINGER
+    // 비교용 빌드: 항상 루트부터 내려감
+    return t->root;
+#endif
+    if (t->root == t->nil)
+    {
+        return t->root;
+    }
+
+    // 양 끝 바깥의 키는 끝 노드 바로 아래가 자리 (정렬된 순서로 넣을 때 O(1))
+    if (key >= t->max_node->key)
+    {
+        return t->max_node;
+    }
+    if (key < t->min_node->key)
+    {
+        return t->min_node;
+    }
+
+    if (hint == NULL || hint == t->nil)
+    {
+        return t->root;
+    }
+
+    node_t *start = (node_t *)hint;
+    int steps = 0;
+
+    if (key >= hint->key)
+    {
+        // 하한은 이미 만족하므로 상한이 key 이상인 서브트리가 나올 때까지 올라감
+        for (;;)
+        {
+            node_t *c = start;
+            while (c->parent != t->nil && c == c->parent->right)
+            {
+                c = c->parent;
+                if (++steps > RBTREE_FINGER_CLIMB)
+                {
+                    return t->root;
+                }
+            }
+            if (c->parent == t->nil || key <= c->parent->key)
+            {
+                return start;
+            }
+            start = c->parent;
+            if (++steps > RBTREE_FINGER_CLIMB)
+            {
+                return t->root;
+            }
+        }
+    }
+
+    // 위와 대칭: 하한이 key 이하인 서브트리가 나올 때까지 올라감
+    for (;;)
+    {
+        node_t *c = start;
+        while (c->parent != t->nil && c == c->parent->left)
+        {
+            c = c->parent;
+            if (++steps > RBTREE_FINGER_CLIMB)
+            {
+                return t->root;
+            }
+        }
+        if (c->parent == t->nil || key >= c->parent->key)
+        {
+            return start;
+        }
+        start = c->parent;
+        if (++steps > RBTREE_FINGER_CLIMB)
+        {
+            return t->root;
+        }
+    }
+}
+
+// 배열 모드의 키들을 Red-Black 트리로 옮기는 함수
+// 트리 할당 안의 노드들을 정렬된 순서대로 최댓값 오른쪽에 붙이므로 노드당 amortized O(1), 노드 주소는 그대로
+static void small_promote(rbtree *t)
+{
+    const int n = t->count;
+
+    t->small_array = 0;
+    t->count = 0;
+    t->min_node = t->max_node = t->nil;
+    for (int i = 0; i < n; i++)
+    {
+        rbtree_link(t, t->max_node, small_node(t, i));
+    }
+}
+
+// 새 노드 하나를 할당하는 함수, 실패하면 NULL
+// 소형 모드 노드에 빈 칸이 있으면 먼저 쓰고, 아니면 아레나(켜져 있으면)나 힙에서 할당
+// digest 트리의 노드는 해시 칸이 붙은 digest_node_t 크기
+static node_t *rbtree_alloc_node(rbtree *t)
+{
+    struct rbtree_small *s = small_of(t);
+    if (t->small && s->used != (1u << RBTREE_SMALL_MAX) - 1)
+    {
+        int slot = 0;
+        while (s->used & (1u << slot))
+        {
+            slot++;
+        }
+        s->used |= 1u << slot;
+        memset(&s->nodes[slot], 0, sizeof(node_t));
+        return &s->nodes[slot];
+    }
+
+    const struct rbtree_features *f = features_of(t);
+    if (f->arena)
+    {
+        return arena_alloc(f->arena);
+    }
+
+    return (node_t *)calloc(1, f->digest ? sizeof(digest_node_t) : sizeof(node_t));
+}
+
+// 키를 가진 새 노드를 만들어 hint 근처에 연결하고, 마지막 삽입 위치(finger)로 기억
+static node_t *rbtree_insert_near(rbtree *t, const node_t *hint, const key_t key)
+{
+    if (t->small_array && t->count == RBTREE_SMALL_MAX)
+    {
+        small_promote(t);
+    }
+
+    // 받은 key 값을 가진 노드 추가
+    node_t *newNode = rbtree_alloc_node(t);
+    if (!newNode)
+    {
+        // 메모리 할당 실패 처리
+        return NULL;
+    }
+
+    if (t->small_array)
+    {
+        newNode->color = RBTREE_BLACK;
+        newNode->parent = newNode->left = newNode->right = t->nil;
+        small_place(t, newNode, key);
+        return newNode;
+    }
+
+    newNode->key = key;
+    rbtree_insert_node(t, rbtree_finger_start(t, hint, key), newNode);
+    t->finger = newNode;
+    return newNode;
+}
+
+// 직전 삽입 위치(finger)를 hint로 쓸 만한지 확인하는 함수
+// key가 finger와 그 바로 옆 노드 사이에 들어갈 때만 쓰고, 아니면 NULL을 돌려 루트부터 내려가게 함
+// 무작위 키는 여기서 걸러지므로 finger에서 올라갔다가 다시 루트부터 내려가는 헛걸음이 없음
+static const node_t *rbtree_finger_hint(const rbtree *t, const key_t key)
+{
+    const node_t *p = t->finger;
+
+    if (p == NULL)
+    {
+        return NULL;
+    }
+    if (key >= p->key)
+    {
+        const node_t *next = rbtree_successor(t, p);
+        return next == t->nil || key <= next->key ? p : NULL;
+    }
+
+    const node_t *prev = rbtree_predecessor(t, p);
+    return prev == t->nil || key >= prev->key ? p : NULL;
+}
+
+// 트리에 새로운 키를 가진 노드를 삽입하는 함수
+// 직전 삽입 위치 바로 옆의 키(거의 정렬된 타임스탬프 등)는 루트부터 내려가지 않음
+node_t *rbtree_insert(rbtree *t, const key_t key)
+{
+    trace_op(t, RBTREE_OP_INSERT, key);
+    node_t *newNode = rbtree_insert_near(t, rbtree_finger_hint(t, key), key);
+
+    if (!newNode)
+    {
+        return NULL;
+    }
+
+    return t->root;
+}
+
+// hint 노드 근처에 키를 삽입하고 새 노드를 반환하는 함수 (hint가 NULL이면 직전 삽입 위치 사용)
+// 다음 삽입의 hint로 반환값을 넘기면 순차 삽입이 amortized O(1)
+node_t *rbtree_insert_hint(rbtree *t, node_t *hint, const key_t key)
+{
+    trace_op(t, RBTREE_OP_INSERT, key);
+    return rbtree_insert_near(t, hint ? hint : rbtree_finger_hint(t, key), key);
+}
+
+// 트리에서 주어진 키를 가진 노드를 찾는 함수
+// TODO: 찾기 구현
+node_t *rbtree_find(const rbtree *t, const key_t key) // t : 트리, key : 검색 노드 키
+{
+    trace_op(t, RBTREE_OP_FIND, key);
+
+    // 배열 모드: 키 RBTREE_SMALL_MAX개를 한 번에 세어 위치를 구함
+    if (t->small_array)
+    {
+        const int i = small_rank(t, key, 1);
+        return i < (int)t->count && small_of(t)->keys[i] == key ? small_node(t, i) : NULL;
+    }
+
+    // 0. 필터가 있으면 없는 키는 트리를 내려가지 않고 바로 거절
+    struct rbtree_filter *filter = t->features ? t->features->filter : NULL;
+    if (filter)
+    {
+        filter_count(&filter->queries);
+        if (!filter_may_contain(filter, key))
+        {
+            filter_count(&filter->negatives);
+            return NULL;
+        }
+    }
+
+    node_t *node = NULL; // 검색할 노드를 저장할 변수
+    node = t->root; // 루트 노드부터 검색 시작
+    // 1. 루트 노드부터 시작하여 키 비교를 통해 왼쪽 또는 오른쪽 자식으로 이동
+    while (node != t->nil && node->key != key)
+    {
+        if (key < node->key)
+        {
+            node = node->left; // 키가 현재 노드의 키보다 작으면 왼쪽 자식으로 이동
+        }
+        else
+        {
+            node = node->right; // 키가 현재 노드의 키보다 크면 오른쪽 자식으로 이동
+        }
+    }
+    // 2. 일치하는 키를 찾으면 해당 노드 반환, 찾지 못하면 NULL 반환
+    if (node == t->nil)
+    {
+        if (filter)
+        {
+            filter_count(&filter->false_positives);
+        }
+        return NULL;
+    }
+
+    // 3. 찾은 노드가 툼스톤이면 같은 키를 가진 살아있는 노드를 찾음
+    // 중복 키는 회전 때문에 양쪽 서브트리에 흩어질 수 있으므로 가장 왼쪽 같은 키부터 훑음
+    if (node->tombstone)
+    {
+        node = skip_dead_forward(t, rbtree_lower_bound(t, key));
+        if (node == t->nil || node->key != key)
+        {
+            if (filter)
+            {
+                filter_count(&filter->false_positives);
+            }
+            return NULL;
+        }
+    }
+
+    return node; // 일치하는 키를 가진 노드 반환
+}
+
+// 트리에서 가장 작은 키를 가진 노드를 찾는 함수
+// 툼스톤은 건너뛰고, 살아있는 노드가 없으면 nil 반환
+node_t *rbtree_min(const rbtree *t)
+{
+    trace_op(t, RBTREE_OP_MIN, 0);
+    // 가장 왼쪽 노드부터 살아있는 노드가 나올 때까지 오른쪽으로 이동
+    return skip_dead_forward(t, rbtree_first(t));
+}
+
+// 트리에서 가장 큰 키를 가진 노드를 찾는 함수
+node_t *rbtree_max(const rbtree *t)
+{
+    trace_op(t, RBTREE_OP_MAX, 0);
+    // 가장 오른쪽 노드부터 살아있는 노드가 나올 때까지 왼쪽으로 이동
+    return skip_dead_backward(t, rbtree_last(t));
+}
+
+// 살아있는 노드 기준 다음 노드를 반환하는 함수 (없으면 NULL)
+node_t *rbtree_next(const rbtree *t, const node_t *p)
+{
+    node_t *next = live_next(t, p);
+    return next == t->nil ? NULL : next;
+}
+
+// 살아있는 노드 기준 이전 노드를 반환하는 함수 (없으면 NULL)
+node_t *rbtree_prev(const rbtree *t, const node_t *p)
+{
+    node_t *prev = skip_dead_backward(t, rbtree_predecessor(t, p));
+    return prev == t->nil ? NULL : prev;
+}
+
+// 특정 서브 노드에서 가장 작은 값을 찾는 함수(노드보다 큰 값중 가장 작은 값 successor)
+node_t *rbtree_minimum(rbtree *t, node_t *y)
+{
+    while (y->left != t->nil) // y의 왼쪽 자식이 nil이 되기 전까지 반복
+    {
+        y = y->left; // y의 왼쪽 자식값을 y에 담는다
+    }
+
+    return y; // r 반환
+}
+
+// 노드를 삭제 후, 삭제된 노드의 자식 노드들을 다른 노드에 연결하는 함수
+void rbtree_transplant(rbtree *t, node_t *u, node_t *v)
+{
+    if (u->parent == t->nil) // 삭제된 노드의 부모 노드가 nil이라면(트리의 루트 노트인지 확인)
+    {
+
+        t->root = v; // 루트 노드를 v로 설정(삭제된 노드의 자식 노드 중 하나)
+    }
+    else if (u == u->parent->left) // 루트노드가 아니라면 삭제 노드가 부모노드의 왼쪽 자식인지 확인
+    {
+        u->parent->left = v; // 왼쪽 자식을 v로 설정
+    }
+    else
+    {                         // 그것도 아니라면
+        u->parent->right = v; // 오른쪽 자식을 v로 설정
+    }
+
+    v->parent = u->parent; // v의 부모를 u의 부모로 설정(v가 u의 위치를 대체)
+}
+
+// 노드 삭제 후 트리 균형을 위한 수정작업 함수
+void rbtree_erase_fixup(rbtree *t, node_t *x) // t : 수정 작업할 트리, x : 삭제된 노드
+{
+    node_t *w;
+    while (x != t->root && x->color == RBTREE_BLACK)
+    {
+        if (x == x->parent->left)
+        {
+            w = x->parent->right; // x의 형제 노드 w를 x의 오른쪽 형제 노드로 설정
+
+            // case 1:
+            if (w->color == RBTREE_RED)
+            {
+                w->color = RBTREE_BLACK; // w의 색상을 검은색으로 변경
+                x->parent->color = RBTREE_RED; // x의 부모 노드의 색상을 빨간색으로 변경
+                rbtree_left_rotate(t, x->parent); // x의 부모 노드를 왼쪽으로 회전
+                w = x->parent->right; // w를 다시 설정
+            }
+
+            // case 2:
+            if (w->left->color == RBTREE_BLACK && w->right->color == RBTREE_BLACK)
+            {
+                w->color = RBTREE_RED; // w의 색상을 빨간색으로 변경
+                x = x->parent; // x를 한 단계 위로 이동
+            }
+            else
+            {
+                // case 3:
+                if (w->right->color == RBTREE_BLACK)
+                {
+                    w->left->color = RBTREE_BLACK; // w의 왼쪽 자식 노드의 색상을 검은색으로 변경
+                    w->color = RBTREE_RED; // w의 색상을 빨간색으로 변경
+                    rbtree_right_rotate(t, w); // w를 오른쪽으로 회전
+                    w = x->parent->right; // w를 다시 설정
+                }
+
+                // case 4:
+                w->color = x->parent->color; // w의 색상을 x의 부모 노드의 색상으로 변경
+                x->parent->color = RBTREE_BLACK; // x의 부모 노드의 색상을 검은색으로 변경
+                w->right->color = RBTREE_BLACK; // w의 오른쪽 자식 노드의 색상을 검은색으로 변경
+                rbtree_left_rotate(t, x->parent); // x의 부모 노드를 왼쪽으로 회전
+                x = t->root; // x를 루트 노드로 설정
+            }
+        }
+        else
+        {
+            // 위의 코드와 동일한 방식으로 x가 x의 부모 노드의 오른쪽 자식인 경우를 처리합니다.
+            w = x->parent->left;
+
+            // case 1:
+            if (w->color == RBTREE_RED)
+            {
+                w->color = RBTREE_BLACK;
+                x->parent->color = RBTREE_RED;
+                rbtree_right_rotate(t, x->parent);
+                w = x->parent->left;
+            }
+
+            // case 2:
+            if (w->right->color == RBTREE_BLACK && w->left->color == RBTREE_BLACK)
+            {
+                w->color = RBTREE_RED;
+                x = x->parent;
+            }
+            else
+            {
+                // case 3:
+                if (w->left->color == RBTREE_BLACK)
+                {
+                    w->right->color = RBTREE_BLACK;
+                    w->color = RBTREE_RED;
+                    rbtree_left_rotate(t, w);
+                    w = x->parent->left;
+                }
+
+                // case 4:
+                w->color = x->parent->color;
+                x->parent->color = RBTREE_BLACK;
+                w->left->color = RBTREE_BLACK;
+                rbtree_right_rotate(t, x->parent);
+                x = t->root;
+            }
+        }
+    }
+    x->color = RBTREE_BLACK; // 삭제된 노드 x의 색상을 검은색으로 변경
+}
+
+// 트리에서 노드를 떼어내고 균형을 맞추는 함수 (메모리는 해제하지 않음)
+static void rbtree_unlink(rbtree *t, node_t *p) // t : 삭제 작업 트리, p : 삭제할 노드
+{
+    if (t->small_array)
+    {
+        small_take(t, p);
+        return;
+    }
+
+    // 캐시된 양 끝 노드가 빠지면 바로 옆 노드로 교체
+    // (두 자식 경우에도 노드 객체 자체가 옮겨질 뿐이므로 포인터는 그대로 유효)
+    if (p == t->min_node)
+    {
+        t->min_node = rbtree_successor(t, p);
+    }
+    if (p == t->max_node)
+    {
+        t->max_node = rbtree_predecessor(t, p);
+    }
+    if (p == t->finger)
+    {
+        t->finger = NULL;
+    }
+    if (t->features && p == t->features->sweep)
+    {
+        t->features->sweep = NULL; // 다음 정리는 처음부터
+    }
+    if (features_of(t)->filter)
+    {
+        filter_remove(features_of(t)->filter, p->key);
+    }
+
+    node_t *y = p; // 삭제할 노드를 y로 설정
+    color_t y_original_color = y->color; // y의 원래 색상을 저장
+    node_t *x; // 삭제 후 대체할 노드를 저장할 변수
+
+    if (p->left == t->nil)
+    {
+        x = p->right; // 삭제할 노드의 오른쪽 자식을 x로 설정
+        rbtree_transplant(t, p, p->right); // p를 p의 오른쪽 자식으로 대체
+    }
+    else if (p->right == t->nil)
+    {
+        x = p->left; // 삭제할 노드의 왼쪽 자식을 x로 설정
+        rbtree_transplant(t, p, p->left); // p를 p의 왼쪽 자식으로 대체
+    }
+    else
+    {
+        y = rbtree_minimum(t, p->right); // 삭제할 노드의 오른쪽 서브트리에서 가장 작은 노드를 y로 설정
+        y_original_color = y->color; // y의 원래 색상을 저장
+        x = y->right; // y의 오른쪽 자식을 x로 설정
+
+        if (y->parent == p)
+        {
+            x->parent = y; // x의 부모를 y로 설정
+        }
+        else
+        {
+            rbtree_transplant(t, y, y->right); // y를 y의 오른쪽 자식으로 대체
+            y->right = p->right; // y의 오른쪽 자식을 p의 오른쪽 자식으로 설정
+            y->right->parent = y; // y의 오른쪽 자식의 부모를 y로 설정
+        } 
+
+        rbtree_transplant(t, p, y); // p를 y로 대체
+        y->left = p->left; // y의 왼쪽 자식을 p의 왼쪽 자식으로 설정
+        y->left->parent = y; // y의 왼쪽 자식의 부모를 y로 설정
+        y->color = p->color; // y의 색상을 p의 색상으로 설정
+    }
+
+    // 구조가 바뀐 가장 아래 지점(x의 부모)부터 루트까지 해시 갱신
+    // x가 nil이어도 transplant에서 nil->parent가 설정되어 있음
+    if (features_of(t)->digest)
+    {
+        rbtree_refresh_path(t, x->parent);
+    }
+
+    if (y_original_color == RBTREE_BLACK)
+    {
+        rbtree_erase_fixup(t, x); // 레드-블랙 트리의 균형을 유지하기 위해 수정 작업을 수행
+    }
+
+    t->count--;
+    if (p->tombstone)
+    {
+        t->tombstones--;
+    }
+}
+
+// 트리가 충분히 작아지면 배열 모드로 되돌리는 함수
+// 노드를 옮기지 않으므로 밖에서 들고 있는 노드 포인터는 그대로 유효
+// 배열은 소형 모드 노드만 가리킬 수 있으므로 malloc한 노드가 남아 있으면 트리로 둠
+static void small_maybe_demote(rbtree *t)
+{
+    if (!t->small || t->small_array || t->count > RBTREE_SMALL_MAX / 2 || t->tombstones > 0)
+    {
+        return;
+    }
+
+    for (node_t *p = rbtree_first(t); p != t->nil; p = rbtree_successor(t, p))
+    {
+        if (!small_owns(t, p))
+        {
+            return;
+        }
+    }
+
+    struct rbtree_small *s = small_of(t);
+    int i = 0;
+    for (node_t *p = rbtree_first(t); p != t->nil; p = rbtree_successor(t, p))
+    {
+        s->keys[i] = p->key;
+        s->slots[i++] = p - s->nodes;
+        if (features_of(t)->filter)
+        {
+            filter_remove(features_of(t)->filter, p->key);
+        }
+    }
+    for (i = 0; i < (int)t->count; i++)
+    {
+        node_t *p = small_node(t, i);
+        p->parent = p->left = p->right = t->nil;
+        p->color = RBTREE_BLACK;
+    }
+
+    t->root = t->nil;
+    t->finger = NULL;
+    t->small_array = 1;
+    small_sync_ends(t);
+}
+
+// 트리에서 노드를 실제로 떼어내고 메모리를 해제하는 함수
+static void rbtree_remove(rbtree *t, node_t *p)
+{
+    rbtree_unlink(t, p);
+    rbtree_free_node(t, p); // 삭제된 노드 p를 메모리에서 해제
+    small_maybe_demote(t);
+}
+
+// 툼스톤 비율을 넘었을 때 erase 한 번이 정리하며 지나갈 노드 수
+#define RBTREE_SWEEP_STEPS 8
+
+// sweep 커서부터 in-order로 최대 RBTREE_SWEEP_STEPS개 노드를 보면서 툼스톤을 하나씩 제거
+// rbtree_compact처럼 O(n)을 한 번에 치르지 않고 erase마다 O(log n)짜리 제거 몇 번으로 나눠 갚음
+// 커서는 끝에 닿으면 처음으로 돌아가므로 비율을 넘은 동안 erase가 이어지면 툼스톤이 결국 모두 빠짐
+static void rbtree_sweep(rbtree *t)
+{
+    struct rbtree_features *f = t->features;
+    node_t *p = f->sweep ? f->sweep : rbtree_first(t);
+
+    for (int i = 0; i < RBTREE_SWEEP_STEPS && t->tombstones > 0; i++)
+    {
+        if (p == t->nil)
+        {
+            p = rbtree_first(t);
+        }
+        node_t *next = rbtree_successor(t, p); // 제거해도 다른 노드 주소는 그대로
+        if (p->tombstone)
+        {
+            rbtree_remove(t, p);
+            if (t->small_array)
+            {
+                f->sweep = NULL; // 배열 모드로 돌아감
+                return;
+            }
+        }
+        p = next;
+    }
+    f->sweep = p == t->nil ? NULL : p;
+}
+
+// 트리에서 주어진 노드를 삭제하는 함수
+// lazy erase 모드에서는 툼스톤 표시만 하고 실제 제거는 나중에 몰아서 처리
+int rbtree_erase(rbtree *t, node_t *p) // t : 삭제 작업 트리, p : 삭제할 노드
+{
+    if (p->tombstone)
+    {
+        return -1; // 이미 삭제된 노드
+    }
+    trace_op(t, RBTREE_OP_ERASE, p->key);
+
+    // 배열 모드에서는 바로 지우는 편이 툼스톤보다 쌈
+    const struct rbtree_features *f = features_of(t);
+    if (!f->lazy_erase || t->small_array)
+    {
+        rbtree_remove(t, p);
+        return 0; // 삭제 작업 완료
+    }
+
+    // 툼스톤이 하나 더 생기면 설정 비율을 넘을 때는 바로 지운 뒤, 쌓인 툼스톤을 조금씩 정리
+    // erase 한 번의 비용은 노드 제거 RBTREE_SWEEP_STEPS + 1번으로 묶임
+    if (f->compact_ratio > 0 && t->tombstones + 1 > f->compact_ratio * t->count)
+    {
+        rbtree_remove(t, p);
+        if (!t->small_array)
+        {
+            rbtree_sweep(t);
+        }
+        return 0;
+    }
+
+    // 툼스톤 표시: 회전이나 free 없이 O(1), digest가 켜져 있으면 경로 해시만 O(log n) 갱신
+    p->tombstone = 1;
+    t->tombstones++;
+    if (f->digest)
+    {
+        rbtree_refresh_path(t, p);
+    }
+
+    return 0;
+}
+
+// 레드-블랙 트리의 모든 키를 배열로 변환하는 함수
+// 툼스톤은 건너뛰고, 트리가 n보다 크면 앞에서부터 n개만 채움
+int rbtree_to_array(const rbtree *t, key_t *arr, const size_t n) {
+    // 배열 포인터가 유효하지 않거나 배열의 크기가 0이면 오류 코드를 반환
+    if (arr == NULL || n == 0) {
+        return -1;
+    }
+    trace_op(t, RBTREE_OP_TO_ARRAY, n > INT_MAX ? INT_MAX : (key_t)n);
+
+    // 가장 작은 노드부터 다음 노드로 이동하며 정렬된 순서로 배열을 채움
+    size_t index = 0;
+    for (node_t *p = skip_dead_forward(t, rbtree_first(t)); p != t->nil && index < n; p = live_next(t, p)) {
+        arr[index++] = p->key;
+    }
+
+    // 함수 성공 반환
+    return 0;
+}
+
+// 병렬 순회
+// 위쪽 몇 층을 중위 순서로 펼쳐 서로 겹치지 않는 조각(서브트리 또는 노드 하나)의 목록을 만들고,
+// 스레드들이 조각을 하나씩 가져가 처리함. 조각은 키 순서대로 놓여 있으므로
+// to_array는 조각별 키 수를 먼저 세어 누적합으로 쓸 위치를 정하고,
+// reduce는 조각별 누적값을 조각 순서대로 합쳐 결합 법칙만 만족하면 결과가 순서대로 나옴
+
+#define PARALLEL_MIN 16384      // 이보다 작은 트리는 스레드를 만드는 비용이 더 큼
+#define PARALLEL_PIECES_PER_THREAD 8
+#define PARALLEL_MAX_DEPTH 14
+#define PARALLEL_MAX_THREADS 256
+#define RBTREE_MAX_HEIGHT 128   // 2 * log2(노드 수 + 1) 상한
+
+typedef struct
+{
+    node_t *root;
+    int single; // root 노드 하나만 (서브트리 아님)
+    size_t count; // 살아있는 키 수 (to_array의 사전 집계)
+    size_t offset;
+} parallel_piece;
+
+// 서브트리를 스택으로 중위 순회하는 반복자 (부모 포인터 없이 조각 안에서만 움직임)
+typedef struct
+{
+    node_t *stack[RBTREE_MAX_HEIGHT];
+    int top;
+} subtree_iter;
+
+static void subtree_push_left(subtree_iter *it, const rbtree *t, node_t *p)
+{
+    for (; p != t->nil; p = p->left)
+    {
+        it->stack[it->top++] = p;
+    }
+}
+
+// 조각의 다음 살아있는 노드, 끝이면 NULL
+static node_t *piece_next(subtree_iter *it, const rbtree *t, const parallel_piece *piece)
+{
+    while (it->top > 0)
+    {
+        node_t *p = it->stack[--it->top];
+        if (!piece->single)
+        {
+            subtree_push_left(it, t, p->right);
+        }
+        if (!p->tombstone)
+        {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+static void piece_begin(subtree_iter *it, const rbtree *t, const parallel_piece *piece)
+{
+    it->top = 0;
+    if (piece->single)
+    {
+        it->stack[it->top++] = piece->root;
+    }
+    else
+    {
+        subtree_push_left(it, t, piece->root);
+    }
+}
+
+// 깊이 depth까지의 노드를 중위 순서로 펼쳐 조각 목록에 추가
+static void parallel_split(const rbtree *t, node_t *p, const int depth, parallel_piece *pieces, size_t *n)
+{
+    if (p == t->nil)
+    {
+        return;
+    }
+    if (depth == 0)
+    {
+        pieces[(*n)++] = (parallel_piece){p, 0, 0, 0};
+        return;
+    }
+
+    parallel_split(t, p->left, depth - 1, pieces, n);
+    pieces[(*n)++] = (parallel_piece){p, 1, 0, 0};
+    parallel_split(t, p->right, depth - 1, pieces, n);
+}
+
+typedef enum
+{
+    PARALLEL_COUNT,
+    PARALLEL_WRITE,
+    PARALLEL_REDUCE
+} parallel_phase_t;
+
+typedef struct
+{
+    const rbtree *t;
+    parallel_piece *pieces;
+    size_t npieces;
+    int nthreads;       // 현재 스레드 포함, 조각 수 이하
+    atomic_size_t next; // 다음에 가져갈 조각 (먼저 끝난 스레드가 더 가져가므로 불균형에 강함)
+    parallel_phase_t phase;
+
+    key_t *arr;
+    size_t n;
+
+    unsigned char *accs; // 조각별 누적값, acc_stride 간격
+    size_t acc_stride;
+    rbtree_map_fn map;
+    void *arg;
+} parallel_job;
+
+static void parallel_piece_run(parallel_job *job, parallel_piece *piece, const size_t i)
+{
+    subtree_iter it;
+    node_t *p;
+
+    piece_begin(&it, job->t, piece);
+    switch (job->phase)
+    {
+    case PARALLEL_COUNT:
+        while (piece_next(&it, job->t, piece))
+        {
+            piece->count++;
+        }
+        break;
+    case PARALLEL_WRITE:
+    {
+        // 앞에서부터 n개만 채우므로 넘치는 조각은 잘라 씀
+        key_t *out = job->arr + piece->offset;
+        key_t *end = job->arr + job->n;
+        while (out < end && (p = piece_next(&it, job->t, piece)))
+        {
+            *out++ = p->key;
+        }
+        break;
+    }
+    case PARALLEL_REDUCE:
+    {
+        void *acc = job->accs + i * job->acc_stride;
+        while ((p = piece_next(&it, job->t, piece)))
+        {
+            job->map(acc, p->key, job->arg);
+        }
+        break;
+    }
+    }
+}
+
+static void *parallel_worker(void *arg)
+{
+    parallel_job *job = (parallel_job *)arg;
+
+    for (size_t i; (i = atomic_fetch_add(&job->next, 1)) < job->npieces;)
+    {
+        if (job->phase != PARALLEL_WRITE || job->pieces[i].offset < job->n)
+        {
+            parallel_piece_run(job, &job->pieces[i], i);
+        }
+    }
+
+    return NULL;
+}
+
+// 현재 스레드를 포함해 job->nthreads개로 job의 한 단계를 돌림
+// 스레드를 만들지 못하면 남은 조각은 현재 스레드가 다 처리하므로 결과는 같음
+static void parallel_run(parallel_job *job, const parallel_phase_t phase)
+{
+    pthread_t *threads = (pthread_t *)malloc((job->nthreads - 1) * sizeof(pthread_t));
+    int started = 0;
+
+    job->phase = phase;
+    atomic_store(&job->next, 0);
+    for (; threads && started < job->nthreads - 1; started++)
+    {
+        if (pthread_create(&threads[started], NULL, parallel_worker, job))
+        {
+            break;
+        }
+    }
+    parallel_worker(job);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+// 스레드가 하나면 트리 전체를 조각 하나로 보고 현재 스레드에서 같은 스택 순회로 처리
+// (부모 포인터를 따라가는 rbtree_successor보다 빠르고, 스레드 수별 비교도 같은 알고리즘끼리 하게 됨)
+static void parallel_serial(const rbtree *t, parallel_job *job, const parallel_phase_t phase)
+{
+    parallel_piece whole = {t->root, 0, 0, 0};
+
+    job->t = t;
+    job->phase = phase;
+    parallel_piece_run(job, &whole, 0);
+}
+
+// nthreads를 정함 (0 이하면 온라인 CPU 수), 작은 트리나 배열 모드는 스레드를 만들 가치가 없어 1
+static int parallel_threads(const rbtree *t, int nthreads)
+{
+    if (nthreads <= 0)
+    {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    if (nthreads > PARALLEL_MAX_THREADS)
+    {
+        nthreads = PARALLEL_MAX_THREADS;
+    }
+
+    return t->small_array || t->count < PARALLEL_MIN ? 1 : nthreads;
+}
+
+// 스레드마다 조각이 여러 개 돌아가도록 위쪽 층을 펼쳐 job을 채움, 실패하면 -1
+static int parallel_prepare(const rbtree *t, parallel_job *job, const int nthreads)
+{
+    int depth = 0;
+    while (depth < PARALLEL_MAX_DEPTH && ((size_t)1 << depth) < (size_t)nthreads * PARALLEL_PIECES_PER_THREAD)
+    {
+        depth++;
+    }
+
+    memset(job, 0, sizeof(*job));
+    job->t = t;
+    job->pieces = (parallel_piece *)malloc(((size_t)2 << depth) * sizeof(parallel_piece));
+    if (!job->pieces)
+    {
+        return -1;
+    }
+    parallel_split(t, t->root, depth, job->pieces, &job->npieces);
+
+    // 조각보다 많은 스레드는 할 일이 없음
+    job->nthreads = (size_t)nthreads < job->npieces ? nthreads : (int)job->npieces;
+    if (job->nthreads < 1)
+    {
+        job->nthreads = 1;
+    }
+    return 0;
+}
+
+// rbtree_to_array를 nthreads개 스레드로 나눠 하는 함수 (결과는 같음), nthreads가 0 이하면 CPU 수
+// 조각별 키 수를 병렬로 센 뒤 누적합으로 각 조각이 쓸 구간을 정해 서로 겹치지 않게 씀
+int rbtree_to_array_parallel(const rbtree *t, key_t *arr, const size_t n, int nthreads)
+{
+    nthreads = parallel_threads(t, nthreads);
+    if (arr == NULL || n == 0 || t->small_array)
+    {
+        return rbtree_to_array(t, arr, n);
+    }
+    trace_op(t, RBTREE_OP_TO_ARRAY, n > INT_MAX ? INT_MAX : (key_t)n);
+
+    parallel_job job;
+    if (nthreads == 1)
+    {
+        memset(&job, 0, sizeof(job));
+        job.arr = arr;
+        job.n = n;
+        parallel_serial(t, &job, PARALLEL_WRITE);
+        return 0;
+    }
+    if (parallel_prepare(t, &job, nthreads))
+    {
+        return -1;
+    }
+    job.arr = arr;
+    job.n = n;
+
+    parallel_run(&job, PARALLEL_COUNT);
+    size_t offset = 0;
+    for (size_t i = 0; i < job.npieces; i++)
+    {
+        job.pieces[i].offset = offset;
+        offset += job.pieces[i].count;
+    }
+    parallel_run(&job, PARALLEL_WRITE);
+
+    free(job.pieces);
+    return 0;
+}
+
+// 모든 키를 키 순서대로 접는 병렬 reduce, 실패하면 -1
+// result는 acc_size 바이트짜리 누적값으로, 들어올 때 항등원이어야 함 (합이면 0, 히스토그램이면 빈 칸)
+// 조각마다 result를 복사한 누적값에 map(acc, key, arg)로 키를 더하고,
+// 끝나면 조각 순서대로 combine(result, acc, arg)로 합침. combine은 결합 법칙만 지키면 됨
+int rbtree_parallel_reduce(const rbtree *t, void *result, const size_t acc_size,
+                           rbtree_map_fn map, rbtree_combine_fn combine, void *arg, int nthreads)
+{
+    nthreads = parallel_threads(t, nthreads);
+    if (t->small_array)
+    {
+        for (node_t *p = skip_dead_forward(t, rbtree_first(t)); p != t->nil; p = live_next(t, p))
+        {
+            map(result, p->key, arg);
+        }
+        return 0;
+    }
+
+    parallel_job job;
+    if (nthreads == 1)
+    {
+        // 조각이 하나뿐이라 result에 바로 누적
+        memset(&job, 0, sizeof(job));
+        job.accs = (unsigned char *)result;
+        job.map = map;
+        job.arg = arg;
+        parallel_serial(t, &job, PARALLEL_REDUCE);
+        return 0;
+    }
+    if (parallel_prepare(t, &job, nthreads))
+    {
+        return -1;
+    }
+
+    // 스레드끼리 캐시 라인을 나눠 쓰지 않도록 누적값 간격을 64바이트 배수로 맞춤
+    const size_t stride = (acc_size + 63) & ~(size_t)63;
+    job.accs = (unsigned char *)malloc(job.npieces * stride);
+    if (!job.accs)
+    {
+        free(job.pieces);
+        return -1;
+    }
+    for (size_t i = 0; i < job.npieces; i++)
+    {
+        memcpy(job.accs + i * stride, result, acc_size);
+    }
+    job.acc_stride = stride;
+    job.map = map;
+    job.arg = arg;
+
+    parallel_run(&job, PARALLEL_REDUCE);
+    for (size_t i = 0; i < job.npieces; i++)
+    {
+        combine(result, job.accs + i * stride, arg);
+    }
+
+    free(job.accs);
+    free(job.pieces);
+    return 0;
+}
+
+// p, q부터 키가 hi 이하인 동안 두 트리를 나란히 걸으며 차이를 콜백으로 알려줌
+static int diff_merge(const rbtree *a, const rbtree *b, node_t *p, node_t *q,
+                      const key_t hi, rbtree_diff_fn cb, void *arg)
+{
+    int ret;
+
+    p = skip_dead_forward(a, p);
+    q = skip_dead_forward(b, q);
+
+    if (p != a->nil && p->key > hi)
+    {
+        p = a->nil;
+    }
+    if (q != b->nil && q->key > hi)
+    {
+        q = b->nil;
+    }
+
+    while (p != a->nil || q != b->nil)
+    {
+        if (p != a->nil && q != b->nil && p->key == q->key)
+        {
+            // 양쪽에 모두 있는 키는 건너뜀
+            p = live_next(a, p);
+            q = live_next(b, q);
+        }
+        else if (q == b->nil || (p != a->nil && p->key < q->key))
+        {
+            if ((ret = cb(p->key, RBTREE_ONLY_LEFT, arg)) != 0)
+            {
+                return ret;
+            }
+            p = live_next(a, p);
+        }
+        else
+        {
+            if ((ret = cb(q->key, RBTREE_ONLY_RIGHT, arg)) != 0)
+            {
+                return ret;
+            }
+            q = live_next(b, q);
+        }
+
+        if (p != a->nil && p->key > hi)
+        {
+            p = a->nil;
+        }
+        if (q != b->nil && q->key > hi)
+        {
+            q = b->nil;
+        }
+    }
+
+    return 0;
+}
+
+// [lo, hi] 범위를 a의 노드를 기준으로 쪼개 가며 비교
+// 범위 해시가 같으면 그 범위 전체를 건너뛰므로, 거의 같은 두 트리는 차이 근처만 내려가게 됨
+static int diff_range(const rbtree *a, const rbtree *b, node_t *guide,
+                      const key_t lo, const key_t hi, rbtree_diff_fn cb, void *arg)
+{
+    int ret;
+
+    if (rbtree_range_digest(a, lo, hi) == rbtree_range_digest(b, lo, hi))
+    {
+        return 0;
+    }
+
+    // 범위 안에 들어오는 첫 노드까지 내려감 (a의 [lo, hi] 키는 모두 그 서브트리 안에 있음)
+    while (guide != a->nil && (guide->key < lo || guide->key > hi))
+    {
+        guide = guide->key < lo ? guide->right : guide->left;
+    }
+
+    if (guide == a->nil)
+    {
+        return diff_merge(a, b, rbtree_lower_bound(a, lo), rbtree_lower_bound(b, lo), hi, cb, arg);
+    }
+
+    const key_t mid = guide->key;
+
+    if (mid > lo && (ret = diff_range(a, b, guide->left, lo, mid - 1, cb, arg)) != 0)
+    {
+        return ret;
+    }
+    if ((ret = diff_merge(a, b, rbtree_lower_bound(a, mid), rbtree_lower_bound(b, mid), mid, cb, arg)) != 0)
+    {
+        return ret;
+    }
+    if (mid < hi)
+    {
+        return diff_range(a, b, guide->right, mid + 1, hi, cb, arg);
+    }
+
+    return 0;
+}
+
+// 두 트리를 중위 순회 순서로 나란히 걸으며 한쪽에만 있는 키를 콜백으로 알려주는 함수
+// multiset 이므로 같은 키가 a에 2개, b에 1개 있으면 남는 1개를 RBTREE_ONLY_LEFT로 보고
+// 콜백이 0이 아닌 값을 반환하면 즉시 멈추고 그 값을 반환, 끝까지 비교하면 0 반환
+// 두 트리 모두 digest가 켜져 있으면 범위 해시가 같은 구간은 통째로 건너뜀
+int rbtree_diff(const rbtree *a, const rbtree *b, rbtree_diff_fn cb, void *arg)
+{
+    if (features_of(a)->digest && features_of(b)->digest && !a->small_array && !b->small_array)
+    {
+        if (*node_digest(a->root) == *node_digest(b->root))
+        {
+            return 0;
+        }
+        return diff_range(a, b, a->root, INT_MIN, INT_MAX, cb, arg);
+    }
+
+    return diff_merge(a, b, rbtree_first(a), rbtree_first(b), INT_MAX, cb, arg);
+}
+
+// 첫 번째 차이에서 바로 멈추는 콜백
+static int diff_stop_any(const key_t key, const diff_side_t side, void *arg)
+{
+    return 1;
+}
+
+// a에만 있는 키가 나오면 멈추는 콜백 (b에만 있는 키는 무시)
+static int diff_stop_left(const key_t key, const diff_side_t side, void *arg)
+{
+    return side == RBTREE_ONLY_LEFT;
+}
+
+// 두 트리가 같은 키들(중복 개수 포함)을 가지고 있으면 1, 아니면 0 반환
+int rbtree_equal(const rbtree *a, const rbtree *b)
+{
+    if (a == b)
+    {
+        return 1;
+    }
+
+    // 해시가 켜져 있으면 O(1) 비교 (64비트 해시 충돌은 무시)
+    if (features_of(a)->digest && features_of(b)->digest && !a->small_array && !b->small_array)
+    {
+        return *node_digest(a->root) == *node_digest(b->root);
+    }
+
+    return rbtree_diff(a, b, diff_stop_any, NULL) == 0;
+}
+
+// a의 모든 키가 b에도 (같은 개수 이상) 있으면 1, 아니면 0 반환
+int rbtree_is_subset(const rbtree *a, const rbtree *b)
+{
+    if (a == b)
+    {
+        return 1;
+    }
+
+    return rbtree_diff(a, b, diff_stop_left, NULL) == 0;
+}
+
+// 서브트리 해시를 후위 순회로 계산
+static uint64_t digest_postorder(const rbtree *t, node_t *p)
+{
+    if (p == t->nil)
+    {
+        return 0;
+    }
+
+    *node_digest(p) = digest_postorder(t, p->left) + digest_postorder(t, p->right) + node_hash(p);
+    return *node_digest(p);
+}
+
+// 노드 p를 digest 배치로 새로 할당한 q로 옮기고, p를 가리키던 캐시 포인터도 q로 바꿈
+static void digest_move(rbtree *t, node_t *p, node_t *q)
+{
+    *q = *p;
+    if (t->min_node == p)
+    {
+        t->min_node = q;
+    }
+    if (t->max_node == p)
+    {
+        t->max_node = q;
+    }
+    if (t->finger == p)
+    {
+        t->finger = q;
+    }
+    if (t->features->sweep == p)
+    {
+        t->features->sweep = q;
+    }
+    rbtree_free_node(t, p); // 소형 모드 노드면 칸만 비움
+}
+
+// 서브트리를 미리 할당해 둔 digest 노드들로 옮겨 심고 새 서브트리 루트를 반환
+// 빈 자식은 새 센티넬 nil로 바꿔 연결
+static node_t *digest_relocate(rbtree *t, node_t *p, node_t *parent, node_t *nil, node_t **fresh, size_t *used)
+{
+    if (p == t->nil)
+    {
+        return nil;
+    }
+
+    node_t *q = fresh[(*used)++];
+    node_t *left = p->left, *right = p->right;
+    digest_move(t, p, q);
+    q->parent = parent;
+    q->left = digest_relocate(t, left, q, nil, fresh, used);
+    q->right = digest_relocate(t, right, q, nil, fresh, used);
+    return q;
+}
+
+// 노드별 서브트리 해시 유지를 켜는 함수 (이미 들어 있는 노드는 한 번에 계산)
+// 해시는 digest_node_t 배치의 노드와 센티넬에만 있으므로 이미 노드가 있으면 모두 새로 할당해 옮기고,
+// 그 전에 받아 둔 노드 포인터는 무효가 됨. 센티넬도 기능 상태 안의 digest 배치로 바뀜
+// digest 노드는 소형 모드 칸에 들어가지 않으므로 소형 모드는 트리로 승격한 뒤 끔
+// 리더가 노드를 보고 있을 수 있는 회수 모드와 노드를 영역째 들고 있는 아레나에서는 옮기지 못해 -1
+int rbtree_enable_digest(rbtree *t)
+{
+    const struct rbtree_features *cur = features_of(t);
+    if (cur->digest)
+    {
+        return 0;
+    }
+    if ((cur->arena && (cur->arena->nregions > 0 || t->count > 0)) || (cur->reclaim && t->count > 0))
+    {
+        return -1;
+    }
+
+    struct rbtree_features *f = features_get(t);
+    if (!f)
+    {
+        return -1;
+    }
+    if (t->small_array)
+    {
+        small_promote(t);
+    }
+
+    node_t *nil = &f->nil.node;
+    nil->color = RBTREE_BLACK;
+    if (t->count > 0)
+    {
+        // 할당이 중간에 실패해도 트리가 섞이지 않도록 새 노드를 먼저 모두 받아 둠
+        node_t **fresh = (node_t **)malloc(t->count * sizeof(node_t *));
+        size_t used = 0;
+        while (fresh && used < t->count && (fresh[used] = (node_t *)calloc(1, sizeof(digest_node_t))))
+        {
+            used++;
+        }
+        if (!fresh || used < t->count)
+        {
+            while (used > 0)
+            {
+                free(fresh[--used]);
+            }
+            free(fresh);
+            return -1;
+        }
+
+        used = 0;
+        t->root = digest_relocate(t, t->root, nil, nil, fresh, &used);
+        free(fresh);
+    }
+    else
+    {
+        t->root = t->min_node = t->max_node = nil;
+    }
+    t->nil = nil;
+    t->small = 0;
+
+    if (f->arena)
+    {
+        f->arena->node_size = sizeof(digest_node_t);
+    }
+    digest_postorder(t, t->root);
+    f->digest = 1;
+    return 0;
+}
+
+// key 미만(strict가 0이면 이하)인 키들의 해시 합
+static uint64_t digest_prefix(const rbtree *t, const key_t key, const int strict)
+{
+    uint64_t sum = 0;
+    node_t *p = t->root;
+
+    while (p != t->nil)
+    {
+        if (strict ? p->key < key : p->key <= key)
+        {
+            // 왼쪽 서브트리와 p는 모두 범위 안
+            sum += *node_digest(p->left) + node_hash(p);
+            p = p->right;
+        }
+        else
+        {
+            p = p->left;
+        }
+    }
+
+    return sum;
+}
+
+// 트리 전체 키의 해시 (모양과 무관), digest가 켜져 있으면 O(1)
+uint64_t rbtree_digest(const rbtree *t)
+{
+    if (features_of(t)->digest && !t->small_array)
+    {
+        return *node_digest(t->root);
+    }
+
+    return rbtree_range_digest(t, INT_MIN, INT_MAX);
+}
+
+// [lo, hi] 범위 키들의 해시, digest가 켜져 있으면 O(log n)
+uint64_t rbtree_range_digest(const rbtree *t, const key_t lo, const key_t hi)
+{
+    if (lo > hi)
+    {
+        return 0;
+    }
+
+    if (features_of(t)->digest && !t->small_array)
+    {
+        return digest_prefix(t, hi, 0) - digest_prefix(t, lo, 1);
+    }
+
+    uint64_t sum = 0;
+    for (node_t *p = skip_dead_forward(t, rbtree_lower_bound(t, lo)); p != t->nil && p->key <= hi; p = live_next(t, p))
+    {
+        sum += key_hash(p->key);
+    }
+
+    return sum;
+}
+
+// 툼스톤이 아닌 노드를 in-order로 한 줄(left 포인터로 연결)로 모으고, 툼스톤은 해제
+// 재귀 깊이는 트리 높이만큼
+static void compact_flatten(rbtree *t, node_t *p, node_t **head, node_t **tail)
+{
+    if (p == t->nil)
+    {
+        return;
+    }
+
+    node_t *left = p->left;
+    node_t *right = p->right;
+
+    compact_flatten(t, left, head, tail);
+    if (p->tombstone)
+    {
+        if (features_of(t)->filter)
+        {
+            filter_remove(features_of(t)->filter, p->key);
+        }
+        rbtree_free_node(t, p);
+    }
+    else
+    {
+        p->left = t->nil;
+        if (*tail)
+        {
+            (*tail)->left = p;
+        }
+        else
+        {
+            *head = p;
+        }
+        *tail = p;
+    }
+    compact_flatten(t, right, head, tail);
+}
+
+// 정렬된 리스트에서 앞의 n개로 완전 균형 트리를 만드는 함수
+// 가장 깊은 층(red_depth)만 빨간색으로 칠하면 모든 경로의 검은 노드 수가 같아짐
+static node_t *compact_build(rbtree *t, node_t **list, const size_t n, const int depth, const int red_depth)
+{
+    if (n == 0)
+    {
+        return t->nil;
+    }
+
+    node_t *left = compact_build(t, list, n / 2, depth + 1, red_depth);
+    node_t *p = *list;
+    *list = p->left;
+
+    p->left = left;
+    if (left != t->nil)
+    {
+        left->parent = p;
+    }
+    p->right = compact_build(t, list, n - n / 2 - 1, depth + 1, red_depth);
+    if (p->right != t->nil)
+    {
+        p->right->parent = p;
+    }
+    p->color = depth == red_depth ? RBTREE_RED : RBTREE_BLACK;
+
+    if (features_of(t)->digest)
+    {
+        rbtree_update_hash(p);
+    }
+
+    return p;
+}
+
+// 툼스톤을 한 번에 제거하는 함수
+// 노드마다 erase fixup을 도는 대신 살아있는 노드들로 균형 트리를 O(n)에 다시 엮음
+// 살아있는 노드의 주소는 바뀌지 않으므로 기존 포인터는 그대로 유효
+int rbtree_compact(rbtree *t)
+{
+    if (t->tombstones == 0)
+    {
+        return 0;
+    }
+
+    node_t *head = NULL;
+    node_t *tail = NULL;
+    size_t live = t->count - t->tombstones;
+
+    compact_flatten(t, t->root, &head, &tail);
+
+    int red_depth = 0;
+    while (((size_t)2 << red_depth) <= live)
+    {
+        red_depth++; // floor(log2(live))
+    }
+
+    t->root = compact_build(t, &head, live, 0, red_depth);
+    t->root->parent = t->nil;
+    if (t->root != t->nil)
+    {
+        t->root->color = RBTREE_BLACK;
+    }
+    t->count = live;
+    t->tombstones = 0;
+    t->finger = t->features->sweep = NULL; // 툼스톤이었다면 이미 해제됨 (툼스톤이 있으면 기능 상태도 있음)
+
+    // 다시 엮었으므로 양 끝 노드를 새로 찾음
+    node_t *p = t->root;
+    while (p != t->nil && p->left != t->nil)
+    {
+        p = p->left;
+    }
+    t->min_node = p;
+    p = t->root;
+    while (p != t->nil && p->right != t->nil)
+    {
+        p = p->right;
+    }
+    t->max_node = p;
+
+    small_maybe_demote(t);
+    return 0;
+}
+
+// 삭제를 툼스톤 표시로 미루는 모드를 켜는 함수
+// ratio: 툼스톤이 전체 노드의 이 비율에 닿으면 이후 erase가 몇 개씩 정리 (0이면 rbtree_compact로 수동으로만)
+int rbtree_enable_lazy_erase(rbtree *t, const double ratio)
+{
+    struct rbtree_features *f = ratio < 0 || ratio > 1 ? NULL : features_get(t);
+    if (!f)
+    {
+        return -1;
+    }
+
+    f->lazy_erase = 1;
+    f->compact_ratio = ratio;
+    return 0;
+}
+
+// 가장 작은 키를 꺼내는 함수 (우선순위 큐의 pop)
+// rbtree_min + rbtree_erase를 한 번에 하는 편의 함수로, 비용은 그 둘과 같음
+// (최솟값까지 내려가는 경로는 캐시에 남아 있어 캐시된 최솟값으로 아끼는 몫이 거의 없음, bench-pq 참고)
+// 앞쪽에 남아 있는 툼스톤은 지나가면서 함께 정리
+int rbtree_pop_min(rbtree *t, key_t *key)
+{
+    while (t->min_node != t->nil && t->min_node->tombstone)
+    {
+        rbtree_remove(t, t->min_node);
+    }
+
+    if (t->min_node == t->nil)
+    {
+        return -1; // 빈 트리
+    }
+
+    if (key)
+    {
+        *key = t->min_node->key;
+    }
+    trace_op(t, RBTREE_OP_ERASE, t->min_node->key);
+    rbtree_remove(t, t->min_node);
+    return 0;
+}
+
+// 가장 큰 키를 꺼내는 함수 (rbtree_pop_min과 대칭)
+int rbtree_pop_max(rbtree *t, key_t *key)
+{
+    while (t->max_node != t->nil && t->max_node->tombstone)
+    {
+        rbtree_remove(t, t->max_node);
+    }
+
+    if (t->max_node == t->nil)
+    {
+        return -1;
+    }
+
+    if (key)
+    {
+        *key = t->max_node->key;
+    }
+    trace_op(t, RBTREE_OP_ERASE, t->max_node->key);
+    rbtree_remove(t, t->max_node);
+    return 0;
+}
+
+// 노드의 키를 바꾸는 함수 (decrease-key / increase-key), 바뀐 노드(p 그대로)를 반환
+// 새 키가 이웃 노드 사이에 들어가면 순서가 그대로이므로 제자리에서 키만 바꾸고,
+// 아니면 노드를 떼어 새 위치에 다시 연결 (free/calloc 없이 같은 노드를 재사용)
+node_t *rbtree_update_key(rbtree *t, node_t *p, const key_t key)
+{
+    if (p->tombstone)
+    {
+        return NULL;
+    }
+
+    // 기록에는 삭제 후 삽입으로 남김 (재생 결과의 키 집합은 같음)
+    trace_op(t, RBTREE_OP_ERASE, p->key);
+    trace_op(t, RBTREE_OP_INSERT, key);
+
+    if (t->small_array)
+    {
+        small_take(t, p);
+        small_place(t, p, key);
+        return p;
+    }
+
+    node_t *prev = rbtree_predecessor(t, p);
+    node_t *next = rbtree_successor(t, p);
+
+    if ((prev == t->nil || prev->key <= key) && (next == t->nil || key <= next->key))
+    {
+        struct rbtree_filter *filter = features_of(t)->filter;
+        if (filter)
+        {
+            filter_add(filter, key);
+            filter_remove(filter, p->key);
+        }
+        p->key = key;
+        if (features_of(t)->digest)
+        {
+            rbtree_refresh_path(t, p);
+        }
+        return p;
+    }
+
+    rbtree_unlink(t, p);
+    p->key = key;
+    rbtree_insert_node(t, rbtree_finger_start(t, NULL, key), p);
+    return p;
+}
+
+// 메모리 사용량
+// malloc은 할당마다 크기 헤더 8바이트를 붙이고 16바이트 단위로 올림하므로(최소 32바이트)
+// 힙에서 받은 블록은 그 크기로 잡아 reserved를 추정함
+static size_t heap_chunk(const size_t size)
+{
+    const size_t chunk = (size + sizeof(size_t) + 15) & ~(size_t)15;
+    return chunk < 32 ? 32 : chunk;
+}
+
+// 트리가 쓰는 메모리를 세는 함수 (노드 수에 비례하지 않으므로 O(1))
+// used는 구조체와 노드가 실제로 차지한 바이트, reserved는 그걸 위해 할당자나 커널에서 받은 바이트
+// 회수 모드에서 유예 중인 노드는 스레드별 목록에 있어 트리 몫으로 세지 않음
+memory_usage_t rbtree_memory_usage(const rbtree *t)
+{
+    memory_usage_t usage = {0};
+    const struct rbtree_features *f = features_of(t);
+
+    usage.used = sizeof(rbtree_block);
+    usage.reserved = heap_chunk(sizeof(rbtree_block));
+    if (t->features)
+    {
+        usage.used += sizeof(struct rbtree_features);
+        usage.reserved += heap_chunk(sizeof(struct rbtree_features));
+    }
+
+    // 소형 모드 노드는 트리 구조체와 같은 할당에 있어 나머지만 따로 셈
+    const struct rbtree_small *s = small_of(t);
+    size_t inline_nodes = 0;
+    for (int i = 0; s && i < RBTREE_SMALL_MAX; i++)
+    {
+        inline_nodes += s->used >> i & 1;
+    }
+    const size_t node_size = f->digest ? sizeof(digest_node_t) : sizeof(node_t);
+    const size_t heap_nodes = t->count - inline_nodes;
+    usage.nodes = t->count;
+    usage.used += heap_nodes * node_size;
+    if (f->arena)
+    {
+        // 자유 목록의 노드와 영역 끝의 안 쓴 부분은 예약만 된 상태
+        const struct rbtree_arena *a = f->arena;
+        usage.reserved += a->nregions * ARENA_REGION + heap_chunk(sizeof(struct rbtree_arena)) +
+                          (a->cap ? heap_chunk(a->cap * sizeof(void *)) : 0);
+        usage.used += sizeof(struct rbtree_arena) + a->nregions * sizeof(void *);
+        usage.hugepages = a->hugepages;
+    }
+    else
+    {
+        usage.reserved += heap_nodes * heap_chunk(node_size);
+    }
+
+    if (f->filter)
+    {
+        // aligned_alloc은 경계를 맞추느라 최대 한 블록을 더 씀
+        const size_t bytes = (char *)f->filter->blocks - (char *)f->filter + (f->filter->mask + 1) * FILTER_BLOCK_BYTES;
+        usage.used += bytes;
+        usage.reserved += heap_chunk(bytes) + FILTER_BLOCK_BYTES;
+    }
+
+    if (f->trace)
+    {
+        // 기록 파일의 stdio 버퍼 포함
+        usage.used += sizeof(struct rbtree_trace) + BUFSIZ;
+        usage.reserved += heap_chunk(sizeof(struct rbtree_trace)) + heap_chunk(BUFSIZ);
+    }
+
+    usage.fragmentation = usage.reserved ? 1 - (double)usage.used / usage.reserved : 0;
+    return usage;
+}
+
+// 계층(tiered) 모드
+// 메모리에는 크기가 정해진 쓰기 버퍼(트리 두 개)만 두고, 가득 차면 중위 순회 순서 그대로
+// 정렬된 불변 파일(run)로 내보냄. 레코드는 (키, 개수 변화량)이라 삭제도 음수 레코드로 내려감
+// 찾기는 버퍼를 먼저 보고, run마다 필터 -> 펜스 인덱스 -> 페이지 하나 pread 순으로 확인하므로
+// run 수가 상한으로 묶여 있는 한 디스크 읽기 횟수도 묶임
+// run은 크기 단계(level)별로 모아, 같은 단계 run이 TIERED_MERGE_RUNS개 쌓이면 한 단계 위 run 하나로 합침
+// (변화량을 더하고 0은 버림). 레코드 하나는 단계마다 한 번만 다시 쓰이므로 병합 비용은 새 데이터에 비례
+// 0단계 병합은 따로 도는 스레드가 맡아, 큰 병합이 도는 동안에도 flush가 그 뒤에 묶이지 않음
+
+#define TIERED_PAGE 256        // 펜스 하나가 가리키는 레코드 수 (pread 한 번 = 2KB)
+#define TIERED_MERGE_RUNS 4    // 같은 단계 run이 이만큼 쌓이면 병합
+#define TIERED_MAX_RUNS 8      // 0단계 run이 이만큼 쌓이면 0단계 병합이 따라올 때까지 flush가 기다림
+#define TIERED_FILTER_KEYS 48  // 512비트 필터 블록당 키 수 (키당 10비트 남짓)
+
+typedef struct
+{
+    int32_t key;
+    int32_t delta;
+} tiered_record;
+
+// 디스크에 있는 정렬된 run 하나, 만든 뒤에는 바뀌지 않음
+typedef struct
+{
+    char *path;
+    int fd;
+    size_t records;
+    key_t min_key, max_key;
+    key_t *fences;   // 페이지마다 첫 키
+    uint64_t *bloom; // 블록마다 512비트
+    size_t bloom_mask;
+    unsigned level; // flush로 만든 run은 0, 단계 L run을 합친 run은 L + 1
+    int busy;       // 병합 대상으로 잡혀 있음 (mutex로 보호)
+} tiered_run;
+
+// 병합 스레드 하나, [min_level, max_level] 단계의 run만 합침
+typedef struct
+{
+    rbtree_tiered *tt;
+    unsigned min_level, max_level;
+    int failed; // 마지막 병합이 디스크 오류로 실패함
+    pthread_t thread;
+} tiered_worker;
+
+struct rbtree_tiered
+{
+    char *dir;
+    size_t buffer_keys;
+    rbtree *ins; // 버퍼에 추가된 키
+    rbtree *del; // 디스크에 있는 키에 대한 삭제 대기
+    atomic_uint next_id; // run 파일 번호 (flush와 병합 스레드가 함께 씀)
+
+    // runs 목록은 mutex와 쓰기 락을 함께 잡고 바꿈 (찾기는 읽기 락, 병합 대상 고르기는 mutex만)
+    // 변화량은 더하기만 하므로 목록 순서는 의미가 없음
+    pthread_rwlock_t lock;
+    tiered_run **runs;
+    size_t nruns, cap;
+
+    pthread_mutex_t mutex; // 아래 상태와 조건 변수용
+    pthread_cond_t wake;   // 병합 스레드 깨우기
+    pthread_cond_t merged; // 병합 완료 알림 (flush 역압)
+    int stop;
+    size_t merges;
+    size_t flushed_records, merged_records;
+    tiered_worker workers[2]; // 0단계 전용, 1단계 이상
+};
+
+// 필터 블록과 블록 안의 비트 위치 6개는 서로 다른 해시에서 뽑아 상관관계를 없앰
+static const uint64_t *tiered_bloom_block(const tiered_run *run, const key_t key, unsigned *pos)
+{
+    uint64_t h = key_hash(~key);
+
+    for (int i = 0; i < FILTER_PROBES; i++)
+    {
+        pos[i] = h & 511;
+        h >>= 9;
+    }
+
+    return run->bloom + ((key_hash(key) >> 32) & run->bloom_mask) * 8;
+}
+
+static int tiered_bloom_may_contain(const tiered_run *run, const key_t key)
+{
+    unsigned pos[FILTER_PROBES];
+    const uint64_t *block = tiered_bloom_block(run, key, pos);
+
+    for (int i = 0; i < FILTER_PROBES; i++)
+    {
+        if (!(block[pos[i] >> 6] >> (pos[i] & 63) & 1))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void tiered_run_free(tiered_run *run, const int remove_file)
+{
+    if (run->fd >= 0)
+    {
+        close(run->fd);
+    }
+    if (remove_file)
+    {
+        unlink(run->path);
+    }
+    free(run->path);
+    free(run->fences);
+    free(run->bloom);
+    free(run);
+}
+
+// run 하나에서 key의 개수 변화량 (필터가 거절하면 디스크를 읽지 않음), 읽기 실패는 -1
+static int tiered_run_lookup(const tiered_run *run, const key_t key, int64_t *delta)
+{
+    *delta = 0;
+    if (run->records == 0 || key < run->min_key || key > run->max_key || !tiered_bloom_may_contain(run, key))
+    {
+        return 0;
+    }
+
+    // key 이하인 마지막 펜스의 페이지에만 key가 있을 수 있음
+    size_t lo = 0, hi = (run->records + TIERED_PAGE - 1) / TIERED_PAGE;
+    while (hi - lo > 1)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (run->fences[mid] <= key)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    tiered_record page[TIERED_PAGE];
+    const size_t first = lo * TIERED_PAGE;
+    const size_t n = run->records - first < TIERED_PAGE ? run->records - first : TIERED_PAGE;
+    const ssize_t want = n * sizeof(tiered_record);
+    if (pread(run->fd, page, want, first * sizeof(tiered_record)) != want)
+    {
+        return -1;
+    }
+
+    size_t l = 0, h = n;
+    while (l < h)
+    {
+        const size_t mid = l + (h - l) / 2;
+        if (page[mid].key < key)
+        {
+            l = mid + 1;
+        }
+        else
+        {
+            h = mid;
+        }
+    }
+    if (l < n && page[l].key == key)
+    {
+        *delta = page[l].delta;
+    }
+
+    return 0;
+}
+
+// run 파일을 순서대로 써 나가는 상태
+typedef struct
+{
+    tiered_run *run;
+    FILE *out;
+    size_t fence_cap;
+} tiered_writer;
+
+// 키가 최대 capacity개인 새 run 파일을 만듦
+static int tiered_writer_open(rbtree_tiered *tt, tiered_writer *w, size_t capacity)
+{
+    tiered_run *run = (tiered_run *)calloc(1, sizeof(tiered_run));
+    if (!run)
+    {
+        return -1;
+    }
+    run->fd = -1;
+
+    size_t nblocks = 1;
+    while (nblocks * TIERED_FILTER_KEYS < capacity)
+    {
+        nblocks <<= 1;
+    }
+    run->bloom = (uint64_t *)calloc(nblocks * 8, sizeof(uint64_t));
+    run->bloom_mask = nblocks - 1;
+
+    const size_t len = strlen(tt->dir) + 32;
+    run->path = (char *)malloc(len);
+    if (run->path)
+    {
+        snprintf(run->path, len, "%s/run-%06u.dat", tt->dir, atomic_fetch_add(&tt->next_id, 1));
+    }
+
+    w->run = run;
+    w->fence_cap = 0;
+    w->out = run->bloom && run->path ? fopen(run->path, "wb") : NULL;
+    if (!w->out)
+    {
+        tiered_run_free(run, 0);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int tiered_writer_add(tiered_writer *w, const key_t key, const int64_t delta)
+{
+    tiered_run *run = w->run;
+
+    if (delta == 0)
+    {
+        return 0; // 더해도 바뀌는 게 없는 레코드는 버림
+    }
+
+    if (run->records % TIERED_PAGE == 0)
+    {
+        const size_t i = run->records / TIERED_PAGE;
+        if (i == w->fence_cap)
+        {
+            w->fence_cap = w->fence_cap ? w->fence_cap * 2 : 16;
+            key_t *fences = (key_t *)realloc(run->fences, w->fence_cap * sizeof(key_t));
+            if (!fences)
+            {
+                return -1;
+            }
+            run->fences = fences;
+        }
+        run->fences[i] = key;
+    }
+
+    unsigned pos[FILTER_PROBES];
+    uint64_t *block = (uint64_t *)tiered_bloom_block(run, key, pos);
+    for (int i = 0; i < FILTER_PROBES; i++)
+    {
+        block[pos[i] >> 6] |= 1ull << (pos[i] & 63);
+    }
+
+    if (run->records == 0)
     {
-        return NULL;
+        run->min_key = key;
     }
+    run->max_key = key;
+    run->records++;
 
-    return node; // 일치하는 키를 가진 노드 반환
+    const tiered_record rec = {key, (int32_t)delta};
+    return fwrite(&rec, sizeof(rec), 1, w->out) == 1 ? 0 : -1;
 }
 
-// 트리에서 가장 작은 키를 가진 노드를 찾는 함수
-node_t *rbtree_min(const rbtree *t)
+// 파일을 닫고 읽기용으로 다시 열어 run을 반환, 실패하면 파일을 지우고 NULL
+static tiered_run *tiered_writer_close(tiered_writer *w, const int failed)
 {
-    // 1. 루트 노드부터 시작하여 가장 왼쪽 노드까지 이동
-    node_t *minNode = t->root;
+    tiered_run *run = w->run;
 
-    if (minNode == t->nil)
+    if (fclose(w->out) || failed || (run->fd = open(run->path, O_RDONLY)) < 0)
     {
-        return minNode;
+        tiered_run_free(run, 1);
+        return NULL;
     }
 
-    while (minNode->left != t->nil)
+    return run;
+}
+
+// 버퍼 트리 t에서 key의 개수
+static size_t tiered_tree_count(const rbtree *t, const key_t key)
+{
+    size_t n = 0;
+
+    for (node_t *p = skip_dead_forward(t, rbtree_lower_bound(t, key)); p != t->nil && p->key == key; p = live_next(t, p))
     {
-        minNode = minNode->left;
+        n++;
     }
 
-    // 2. 가장 왼쪽 노드 반환
-    return minNode;
+    return n;
 }
 
-// 트리에서 가장 큰 키를 가진 노드를 찾는 함수
-node_t *rbtree_max(const rbtree *t)
+// 디스크에 있는 key의 개수 (모든 run의 변화량 합), 읽기 실패는 -1
+static int64_t tiered_disk_count(rbtree_tiered *tt, const key_t key)
 {
-    // 1. 루트 노드부터 시작하여 가장 오른쪽 노드까지 이동
-    node_t *maxNode = t->root;
+    int64_t total = 0;
 
-    if (maxNode == t->nil)
+    pthread_rwlock_rdlock(&tt->lock);
+    for (size_t i = 0; i < tt->nruns; i++)
     {
-        return maxNode;
+        int64_t delta;
+        if (tiered_run_lookup(tt->runs[i], key, &delta))
+        {
+            total = -1;
+            break;
+        }
+        total += delta;
     }
+    pthread_rwlock_unlock(&tt->lock);
 
-    while (maxNode->right != t->nil)
-    {
-        maxNode = maxNode->right;
-    }
-    // 2. 가장 오른쪽 노드 반환
-    return maxNode;
+    return total;
 }
 
-// 특정 서브 노드에서 가장 작은 값을 찾는 함수(노드보다 큰 값중 가장 작은 값 successor)
-node_t *rbtree_minimum(rbtree *t, node_t *y)
+// 병합 대상 run 하나를 순서대로 읽는 커서
+typedef struct
 {
-    while (y->left != t->nil) // y의 왼쪽 자식이 nil이 되기 전까지 반복
-    {
-        y = y->left; // y의 왼쪽 자식값을 y에 담는다
-    }
+    FILE *in;
+    tiered_record rec;
+    int done;
+} tiered_cursor;
 
-    return y; // r 반환
+static void tiered_cursor_next(tiered_cursor *c)
+{
+    c->done = fread(&c->rec, sizeof(c->rec), 1, c->in) != 1;
 }
 
-// 노드를 삭제 후, 삭제된 노드의 자식 노드들을 다른 노드에 연결하는 함수
-void rbtree_transplant(rbtree *t, node_t *u, node_t *v)
+// run k개(TIERED_MERGE_RUNS 이하)를 하나로 합치는 함수 (runs 목록은 건드리지 않음), 실패하면 NULL
+static tiered_run *tiered_merge_runs(rbtree_tiered *tt, tiered_run **runs, const size_t k)
 {
-    if (u->parent == t->nil) // 삭제된 노드의 부모 노드가 nil이라면(트리의 루트 노트인지 확인)
-    {
+    tiered_cursor cursors[TIERED_MERGE_RUNS];
+    size_t capacity = 0;
+    int failed = 0;
 
-        t->root = v; // 루트 노드를 v로 설정(삭제된 노드의 자식 노드 중 하나)
+    for (size_t i = 0; i < k; i++)
+    {
+        cursors[i].in = fopen(runs[i]->path, "rb");
+        failed |= !cursors[i].in;
+        if (cursors[i].in)
+        {
+            tiered_cursor_next(&cursors[i]);
+        }
+        capacity += runs[i]->records;
     }
-    else if (u == u->parent->left) // 루트노드가 아니라면 삭제 노드가 부모노드의 왼쪽 자식인지 확인
+
+    tiered_writer w;
+    if (!failed && tiered_writer_open(tt, &w, capacity) == 0)
     {
-        u->parent->left = v; // 왼쪽 자식을 v로 설정
+        // 커서 중 가장 작은 키의 변화량을 모두 더해 한 레코드로 씀 (k가 작아 선형 탐색)
+        for (;;)
+        {
+            int found = 0;
+            key_t key = 0;
+            for (size_t i = 0; i < k; i++)
+            {
+                if (!cursors[i].done && (!found || cursors[i].rec.key < key))
+                {
+                    key = cursors[i].rec.key;
+                    found = 1;
+                }
+            }
+            if (!found)
+            {
+                break;
+            }
+
+            int64_t delta = 0;
+            for (size_t i = 0; i < k; i++)
+            {
+                if (!cursors[i].done && cursors[i].rec.key == key)
+                {
+                    delta += cursors[i].rec.delta;
+                    tiered_cursor_next(&cursors[i]);
+                }
+            }
+            failed |= tiered_writer_add(&w, key, delta);
+        }
+
+        for (size_t i = 0; i < k; i++)
+        {
+            failed |= ferror(cursors[i].in);
+        }
     }
     else
-    {                         // 그것도 아니라면
-        u->parent->right = v; // 오른쪽 자식을 v로 설정
+    {
+        failed = 1;
+        w.out = NULL;
     }
 
-    v->parent = u->parent; // v의 부모를 u의 부모로 설정(v가 u의 위치를 대체)
+    for (size_t i = 0; i < k; i++)
+    {
+        if (cursors[i].in)
+        {
+            fclose(cursors[i].in);
+        }
+    }
+
+    return w.out ? tiered_writer_close(&w, failed) : NULL;
 }
 
-// 노드 삭제 후 트리 균형을 위한 수정작업 함수
-void rbtree_erase_fixup(rbtree *t, node_t *x) // t : 수정 작업할 트리, x : 삭제된 노드
+// 맡은 단계 중 병합 대상이 아닌 run이 TIERED_MERGE_RUNS개 이상인 가장 낮은 단계에서 run을 골라 busy로 표시
+// 고른 수를 반환 (mutex를 잡고 호출)
+static size_t tiered_pick_victims(rbtree_tiered *tt, const tiered_worker *worker, tiered_run **victims)
 {
-    node_t *w;
-    while (x != t->root && x->color == RBTREE_BLACK)
+    for (unsigned level = worker->min_level; level <= worker->max_level; level++)
     {
-        if (x == x->parent->left)
+        size_t k = 0, seen = 0;
+        for (size_t i = 0; i < tt->nruns && k < TIERED_MERGE_RUNS; i++)
         {
-            w = x->parent->right; // x의 형제 노드 w를 x의 오른쪽 형제 노드로 설정
-
-            // case 1:
-            if (w->color == RBTREE_RED)
+            if (tt->runs[i]->level == level)
             {
-                w->color = RBTREE_BLACK; // w의 색상을 검은색으로 변경
-                x->parent->color = RBTREE_RED; // x의 부모 노드의 색상을 빨간색으로 변경
-                rbtree_left_rotate(t, x->parent); // x의 부모 노드를 왼쪽으로 회전
-                w = x->parent->right; // w를 다시 설정
+                seen++;
+                if (!tt->runs[i]->busy)
+                {
+                    victims[k++] = tt->runs[i];
+                }
             }
-
-            // case 2:
-            if (w->left->color == RBTREE_BLACK && w->right->color == RBTREE_BLACK)
+        }
+        if (k == TIERED_MERGE_RUNS)
+        {
+            for (size_t i = 0; i < k; i++)
             {
-                w->color = RBTREE_RED; // w의 색상을 빨간색으로 변경
-                x = x->parent; // x를 한 단계 위로 이동
+                victims[i]->busy = 1;
             }
-            else
+            return k;
+        }
+        if (seen == 0 && level > worker->min_level)
+        {
+            break; // 더 높은 단계는 이 단계를 거쳐야만 생김
+        }
+    }
+
+    return 0;
+}
+
+// 백그라운드 병합 스레드
+// 병합 중에도 찾기와 flush, 다른 단계의 병합은 계속되고, 목록을 바꿀 때만 잠깐 쓰기 락을 잡음
+static void *tiered_merger(void *arg)
+{
+    tiered_worker *worker = (tiered_worker *)arg;
+    rbtree_tiered *tt = worker->tt;
+    tiered_run *victims[TIERED_MERGE_RUNS];
+
+    pthread_mutex_lock(&tt->mutex);
+    while (!tt->stop)
+    {
+        const size_t k = worker->failed ? 0 : tiered_pick_victims(tt, worker, victims);
+        if (k == 0)
+        {
+            // 디스크 오류로 실패했으면 다음 flush가 깨울 때까지 쉼 (run은 그대로라 찾기는 계속 맞음)
+            pthread_cond_wait(&tt->wake, &tt->mutex);
+            worker->failed = 0;
+            continue;
+        }
+
+        pthread_mutex_unlock(&tt->mutex);
+        tiered_run *merged = tiered_merge_runs(tt, victims, k);
+        pthread_mutex_lock(&tt->mutex);
+
+        if (merged)
+        {
+            merged->level = victims[0]->level + 1;
+
+            // 그 사이 목록이 바뀌었을 수 있으므로 자리 대신 포인터로 찾아 뺌
+            pthread_rwlock_wrlock(&tt->lock);
+            size_t n = 0;
+            for (size_t i = 0; i < tt->nruns; i++)
             {
-                // case 3:
-                if (w->right->color == RBTREE_BLACK)
+                size_t j = 0;
+                while (j < k && tt->runs[i] != victims[j])
                 {
-                    w->left->color = RBTREE_BLACK; // w의 왼쪽 자식 노드의 색상을 검은색으로 변경
-                    w->color = RBTREE_RED; // w의 색상을 빨간색으로 변경
-                    rbtree_right_rotate(t, w); // w를 오른쪽으로 회전
-                    w = x->parent->right; // w를 다시 설정
+                    j++;
+                }
+                if (j == k)
+                {
+                    tt->runs[n++] = tt->runs[i];
                 }
-
-                // case 4:
-                w->color = x->parent->color; // w의 색상을 x의 부모 노드의 색상으로 변경
-                x->parent->color = RBTREE_BLACK; // x의 부모 노드의 색상을 검은색으로 변경
-                w->right->color = RBTREE_BLACK; // w의 오른쪽 자식 노드의 색상을 검은색으로 변경
-                rbtree_left_rotate(t, x->parent); // x의 부모 노드를 왼쪽으로 회전
-                x = t->root; // x를 루트 노드로 설정
             }
+            tt->runs[n++] = merged;
+            tt->nruns = n;
+            pthread_rwlock_unlock(&tt->lock);
+
+            tt->merges++;
+            tt->merged_records += merged->records;
+            pthread_cond_broadcast(&tt->wake); // 한 단계 위 병합이 가능해졌을 수 있음
         }
         else
         {
-            // 위의 코드와 동일한 방식으로 x가 x의 부모 노드의 오른쪽 자식인 경우를 처리합니다.
-            w = x->parent->left;
-
-            // case 1:
-            if (w->color == RBTREE_RED)
+            for (size_t i = 0; i < k; i++)
             {
-                w->color = RBTREE_BLACK;
-                x->parent->color = RBTREE_RED;
-                rbtree_right_rotate(t, x->parent);
-                w = x->parent->left;
+                victims[i]->busy = 0;
             }
+        }
+        worker->failed = !merged;
+        pthread_cond_broadcast(&tt->merged);
 
-            // case 2:
-            if (w->right->color == RBTREE_BLACK && w->left->color == RBTREE_BLACK)
+        if (merged)
+        {
+            // 파일 지우기는 락 밖에서 (목록에서 빠졌으므로 다른 스레드는 더 이상 보지 않음)
+            pthread_mutex_unlock(&tt->mutex);
+            for (size_t i = 0; i < k; i++)
             {
-                w->color = RBTREE_RED;
-                x = x->parent;
+                tiered_run_free(victims[i], 1);
             }
-            else
-            {
-                // case 3:
-                if (w->left->color == RBTREE_BLACK)
-                {
-                    w->right->color = RBTREE_BLACK;
-                    w->color = RBTREE_RED;
-                    rbtree_left_rotate(t, w);
-                    w = x->parent->left;
-                }
+            pthread_mutex_lock(&tt->mutex);
+        }
+    }
+    pthread_mutex_unlock(&tt->mutex);
 
-                // case 4:
-                w->color = x->parent->color;
-                x->parent->color = RBTREE_BLACK;
-                w->left->color = RBTREE_BLACK;
-                rbtree_right_rotate(t, x->parent);
-                x = t->root;
+    return NULL;
+}
+
+// 병합 스레드 앞에서부터 n개를 멈추고 기다리는 함수
+static void tiered_stop(rbtree_tiered *tt, const size_t n)
+{
+    pthread_mutex_lock(&tt->mutex);
+    tt->stop = 1;
+    pthread_cond_broadcast(&tt->wake);
+    pthread_mutex_unlock(&tt->mutex);
+    for (size_t i = 0; i < n; i++)
+    {
+        pthread_join(tt->workers[i].thread, NULL);
+    }
+}
+
+// 디렉터리 dir에 run 파일을 두는 계층 모드 집합을 여는 함수
+// buffer_keys는 메모리 버퍼에 둘 최대 키 수, 실패하면 NULL
+// run 파일은 이 핸들 전용이며 rbtree_tiered_close에서 모두 지움
+rbtree_tiered *rbtree_tiered_open(const char *dir, size_t buffer_keys)
+{
+    rbtree_tiered *tt = (rbtree_tiered *)calloc(1, sizeof(rbtree_tiered));
+    if (!tt)
+    {
+        return NULL;
+    }
+
+    tt->dir = strdup(dir);
+    tt->buffer_keys = buffer_keys ? buffer_keys : 1;
+    tt->ins = new_rbtree();
+    tt->del = new_rbtree();
+    pthread_rwlock_init(&tt->lock, NULL);
+    pthread_mutex_init(&tt->mutex, NULL);
+    pthread_cond_init(&tt->wake, NULL);
+    pthread_cond_init(&tt->merged, NULL);
+
+    size_t started = 0;
+    if (tt->dir && tt->ins && tt->del)
+    {
+        for (; started < 2; started++)
+        {
+            tiered_worker *worker = &tt->workers[started];
+            worker->tt = tt;
+            worker->min_level = started == 0 ? 0 : 1;
+            worker->max_level = started == 0 ? 0 : UINT_MAX;
+            if (pthread_create(&worker->thread, NULL, tiered_merger, worker))
+            {
+                break;
             }
         }
     }
-    x->color = RBTREE_BLACK; // 삭제된 노드 x의 색상을 검은색으로 변경
+
+    if (started < 2)
+    {
+        tiered_stop(tt, started);
+        free(tt->dir);
+        if (tt->ins)
+        {
+            delete_rbtree(tt->ins);
+        }
+        if (tt->del)
+        {
+            delete_rbtree(tt->del);
+        }
+        free(tt);
+        return NULL;
+    }
+
+    return tt;
 }
 
-// 트리에서 주어진 노드를 삭제하는 함수
-// TODO: 삭제 구현
-int rbtree_erase(rbtree *t, node_t *p) // t : 삭제 작업 트리, p : 삭제할 노드
+void rbtree_tiered_close(rbtree_tiered *tt)
 {
-    node_t *y = p; // 삭제할 노드를 y로 설정
-    color_t y_original_color = y->color; // y의 원래 색상을 저장
-    node_t *x; // 삭제 후 대체할 노드를 저장할 변수
+    tiered_stop(tt, 2);
 
-    if (p->left == t->nil)
+    for (size_t i = 0; i < tt->nruns; i++)
     {
-        x = p->right; // 삭제할 노드의 오른쪽 자식을 x로 설정
-        rbtree_transplant(t, p, p->right); // p를 p의 오른쪽 자식으로 대체
+        tiered_run_free(tt->runs[i], 1);
     }
-    else if (p->right == t->nil)
+    free(tt->runs);
+    pthread_rwlock_destroy(&tt->lock);
+    pthread_mutex_destroy(&tt->mutex);
+    pthread_cond_destroy(&tt->wake);
+    pthread_cond_destroy(&tt->merged);
+    delete_rbtree(tt->ins);
+    delete_rbtree(tt->del);
+    free(tt->dir);
+    free(tt);
+}
+
+// 단계가 level인 run 수 (mutex를 잡고 호출)
+static size_t tiered_level_runs(const rbtree_tiered *tt, const unsigned level)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < tt->nruns; i++)
     {
-        x = p->left; // 삭제할 노드의 왼쪽 자식을 x로 설정
-        rbtree_transplant(t, p, p->left); // p를 p의 왼쪽 자식으로 대체
+        n += tt->runs[i]->level == level;
     }
-    else
+
+    return n;
+}
+
+// 메모리 버퍼를 run 하나로 내보내는 함수, 실패하면 -1 (버퍼는 그대로 남음)
+// 0단계 run이 TIERED_MAX_RUNS개면 0단계 병합이 끝날 때까지 기다려 찾기 비용이 계속 늘지 않게 함
+// 기다리는 것은 크기가 버퍼 몇 개 분량인 0단계 병합뿐이라 큰 병합 뒤에 묶이지 않음
+int rbtree_tiered_flush(rbtree_tiered *tt)
+{
+    if (tt->ins->count == 0 && tt->del->count == 0)
     {
-        y = rbtree_minimum(t, p->right); // 삭제할 노드의 오른쪽 서브트리에서 가장 작은 노드를 y로 설정
-        y_original_color = y->color; // y의 원래 색상을 저장
-        x = y->right; // y의 오른쪽 자식을 x로 설정
+        return 0;
+    }
 
-        if (y->parent == p)
+    tiered_writer w;
+    if (tiered_writer_open(tt, &w, tt->ins->count + tt->del->count))
+    {
+        return -1;
+    }
+
+    // 두 버퍼 트리를 중위 순회로 함께 훑으며 키마다 (추가 수 - 삭제 수)를 씀
+    node_t *a = skip_dead_forward(tt->ins, rbtree_first(tt->ins));
+    node_t *d = skip_dead_forward(tt->del, rbtree_first(tt->del));
+    int failed = 0;
+    while (a != tt->ins->nil || d != tt->del->nil)
+    {
+        const key_t key = d == tt->del->nil || (a != tt->ins->nil && a->key < d->key) ? a->key : d->key;
+        int64_t delta = 0;
+        for (; a != tt->ins->nil && a->key == key; a = live_next(tt->ins, a))
         {
-            x->parent = y; // x의 부모를 y로 설정
+            delta++;
         }
-        else
+        for (; d != tt->del->nil && d->key == key; d = live_next(tt->del, d))
         {
-            rbtree_transplant(t, y, y->right); // y를 y의 오른쪽 자식으로 대체
-            y->right = p->right; // y의 오른쪽 자식을 p의 오른쪽 자식으로 설정
-            y->right->parent = y; // y의 오른쪽 자식의 부모를 y로 설정
-        } 
+            delta--;
+        }
+        failed |= tiered_writer_add(&w, key, delta);
+    }
 
-        rbtree_transplant(t, p, y); // p를 y로 대체
-        y->left = p->left; // y의 왼쪽 자식을 p의 왼쪽 자식으로 설정
-        y->left->parent = y; // y의 왼쪽 자식의 부모를 y로 설정
-        y->color = p->color; // y의 색상을 p의 색상으로 설정
+    tiered_run *run = tiered_writer_close(&w, failed);
+    if (!run)
+    {
+        return -1;
     }
 
-    if (y_original_color == RBTREE_BLACK)
+    pthread_mutex_lock(&tt->mutex);
+    tiered_worker *minor = &tt->workers[0];
+    while (tiered_level_runs(tt, 0) >= TIERED_MAX_RUNS && !minor->failed)
     {
-        rbtree_erase_fixup(t, x); // 레드-블랙 트리의 균형을 유지하기 위해 수정 작업을 수행
+        pthread_cond_wait(&tt->merged, &tt->mutex);
+    }
+    if (tiered_level_runs(tt, 0) >= TIERED_MAX_RUNS)
+    {
+        // 0단계 병합이 실패해 멈춰 있으면 더 쌓을 자리가 없음, 병합 스레드를 깨워 다시 시도하게 함
+        minor->failed = 0;
+        pthread_cond_broadcast(&tt->wake);
+        pthread_mutex_unlock(&tt->mutex);
+        tiered_run_free(run, 1);
+        return -1;
+    }
+    if (tt->nruns == tt->cap)
+    {
+        const size_t cap = tt->cap ? tt->cap * 2 : 16;
+        pthread_rwlock_wrlock(&tt->lock);
+        tiered_run **runs = (tiered_run **)realloc(tt->runs, cap * sizeof(tiered_run *));
+        if (runs)
+        {
+            tt->runs = runs;
+            tt->cap = cap;
+        }
+        pthread_rwlock_unlock(&tt->lock);
+        if (!runs)
+        {
+            pthread_mutex_unlock(&tt->mutex);
+            tiered_run_free(run, 1);
+            return -1;
+        }
     }
 
-    free(p); // 삭제된 노드 p를 메모리에서 해제
+    pthread_rwlock_wrlock(&tt->lock);
+    tt->runs[tt->nruns++] = run;
+    pthread_rwlock_unlock(&tt->lock);
+    tt->flushed_records += run->records;
+    pthread_cond_broadcast(&tt->wake);
+    pthread_mutex_unlock(&tt->mutex);
+
+    delete_rbtree(tt->ins);
+    delete_rbtree(tt->del);
+    tt->ins = new_rbtree();
+    tt->del = new_rbtree();
+    return tt->ins && tt->del ? 0 : -1;
+}
 
-    return 0; // 삭제 작업 완료
+// 버퍼가 차면 비우는 함수
+static int tiered_maybe_flush(rbtree_tiered *tt)
+{
+    return tt->ins->count + tt->del->count >= tt->buffer_keys ? rbtree_tiered_flush(tt) : 0;
 }
 
-// 중위 순회를 수행하며 키 값을 배열에 저장하는 함수
-void inorder_traversal(node_t *node, int *index, int *arr) {
-    // 현재 노드가 Nil이거나 인덱스가 유효하지 않으면 순회 중단
-    if (node == NULL || node->key == 0 || *index <= -1)
+int rbtree_tiered_insert(rbtree_tiered *tt, const key_t key)
+{
+    if (!rbtree_insert(tt->ins, key))
     {
-        return;
+        return -1;
     }
 
-    // 왼쪽 서브트리를 순회
-    inorder_traversal(node->left, index, arr);
+    return tiered_maybe_flush(tt);
+}
+
+// key를 하나 지우는 함수, 없으면 -1
+// 버퍼에 있으면 거기서 바로 지우고, 디스크에만 있으면 삭제 대기로 기록해 다음 flush 때 내려보냄
+int rbtree_tiered_erase(rbtree_tiered *tt, const key_t key)
+{
+    node_t *p = rbtree_find(tt->ins, key);
+    if (p)
+    {
+        rbtree_erase(tt->ins, p);
+        return 0;
+    }
 
-    // 현재 노드 방문
-    // 현재 노드의 키를 배열의 현재 index 위치에 저장하고, index 증가
-    if (*index >= 0)
+    const int64_t on_disk = tiered_disk_count(tt, key);
+    if (on_disk <= (int64_t)tiered_tree_count(tt->del, key) || !rbtree_insert(tt->del, key))
     {
-        arr[*index] = node->key;
-        (*index)++;
+        return -1;
     }
 
-    // 오른쪽 서브트리를 순회
-    inorder_traversal(node->right, index, arr);
+    return tiered_maybe_flush(tt);
 }
 
-// 레드-블랙 트리의 모든 키를 배열로 변환하는 함수
-int rbtree_to_array(const rbtree *t, key_t *arr, const size_t n) {
-    // 배열 포인터가 유효하지 않거나 배열의 크기가 0이면 오류 코드를 반환
-    if (arr == NULL || n == 0) {
+// key의 개수 (multiset), 디스크 읽기에 실패하면 -1
+int64_t rbtree_tiered_count(rbtree_tiered *tt, const key_t key)
+{
+    const int64_t on_disk = tiered_disk_count(tt, key);
+    if (on_disk < 0)
+    {
         return -1;
     }
 
-    int index = 0;
+    return on_disk - (int64_t)tiered_tree_count(tt->del, key) + (int64_t)tiered_tree_count(tt->ins, key);
+}
 
-    // 트리의 루트부터 시작하여 중위 순회 수행
-    // 이 순회는 트리의 키를 정렬된 순서로 배열에 채움
-    inorder_traversal(t->root, &index, arr);
+int rbtree_tiered_stats(rbtree_tiered *tt, tiered_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
 
-    // 순회가 끝난 후, 인덱스는 배열에 저장된 키의 수와 같아야 함
-    // 인덱스가 배열의 크기를 초과하면 오류 코드를 반환
-    if (index > n) {
-        return -1;
+    pthread_rwlock_rdlock(&tt->lock);
+    stats->runs = tt->nruns;
+    for (size_t i = 0; i < tt->nruns; i++)
+    {
+        const tiered_run *run = tt->runs[i];
+        stats->run_records += run->records;
+        stats->index_bytes += (run->records + TIERED_PAGE - 1) / TIERED_PAGE * sizeof(key_t) + (run->bloom_mask + 1) * 64;
     }
-    
-    // 함수 성공 반환
+    pthread_rwlock_unlock(&tt->lock);
+
+    pthread_mutex_lock(&tt->mutex);
+    stats->merges = tt->merges;
+    stats->flushed_records = tt->flushed_records;
+    stats->merged_records = tt->merged_records;
+    pthread_mutex_unlock(&tt->mutex);
+
+    stats->buffered = tt->ins->count + tt->del->count;
     return 0;
-}
\ No newline at end of file
+}
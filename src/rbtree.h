@@ -2,13 +2,15 @@
 #define _RBTREE_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 typedef enum { RBTREE_RED, RBTREE_BLACK } color_t;
 
 typedef int key_t;
 
 typedef struct node_t {
-  color_t color;
+  color_t color : 1;
+  unsigned int tombstone : 1;  // shares the color word, lazily erased
   key_t key;
   struct node_t *parent, *left, *right;
 } node_t;
@@ -16,17 +18,129 @@ typedef struct node_t {
 typedef struct {
   node_t *root;
   node_t *nil;  // for sentinel
+  // digest, lazy erase, filter, trace, arena and reclamation state,
+  // allocated by the first rbtree_enable_* call (NULL for plain trees)
+  struct rbtree_features *features;
+  int small;        // may use the small-mode array (RBTREE_SMALL_MODE builds)
+  int small_array;  // keys are in the small-mode array, root is nil
+  size_t count;       // nodes linked in the tree, tombstones included
+  size_t tombstones;
+  node_t *min_node, *max_node;  // cached extremes, tombstones included
+  node_t *finger;               // last insert position, NULL if none
 } rbtree;
 
 rbtree *new_rbtree(void);
 void delete_rbtree(rbtree *);
 
 node_t *rbtree_insert(rbtree *, const key_t);
+node_t *rbtree_insert_hint(rbtree *, node_t *, const key_t);
 node_t *rbtree_find(const rbtree *, const key_t);
 node_t *rbtree_min(const rbtree *);
 node_t *rbtree_max(const rbtree *);
 int rbtree_erase(rbtree *, node_t *);
 
+node_t *rbtree_next(const rbtree *, const node_t *);
+node_t *rbtree_prev(const rbtree *, const node_t *);
+
+int rbtree_pop_min(rbtree *, key_t *);
+int rbtree_pop_max(rbtree *, key_t *);
+node_t *rbtree_update_key(rbtree *, node_t *, const key_t);
+
 int rbtree_to_array(const rbtree *, key_t *, const size_t);
 
+// parallel traversal; nthreads <= 0 means one per online CPU
+typedef void (*rbtree_map_fn)(void *acc, const key_t key, void *arg);
+typedef void (*rbtree_combine_fn)(void *acc, const void *other, void *arg);
+
+int rbtree_to_array_parallel(const rbtree *, key_t *, const size_t, int);
+int rbtree_parallel_reduce(const rbtree *, void *, const size_t, rbtree_map_fn,
+                           rbtree_combine_fn, void *, int);
+
+typedef enum { RBTREE_ONLY_LEFT, RBTREE_ONLY_RIGHT } diff_side_t;
+typedef int (*rbtree_diff_fn)(const key_t, const diff_side_t, void *);
+
+int rbtree_equal(const rbtree *, const rbtree *);
+int rbtree_is_subset(const rbtree *, const rbtree *);
+int rbtree_diff(const rbtree *, const rbtree *, rbtree_diff_fn, void *);
+
+// digest trees keep an 8-byte subtree hash next to each node and the sentinel;
+// enabling it moves the nodes and t->nil, so earlier node pointers become invalid
+int rbtree_enable_digest(rbtree *);
+uint64_t rbtree_digest(const rbtree *);
+uint64_t rbtree_range_digest(const rbtree *, const key_t, const key_t);
+
+int rbtree_enable_lazy_erase(rbtree *, const double);
+int rbtree_compact(rbtree *);
+
+typedef struct {
+  size_t queries;          // finds that consulted the filter
+  size_t negatives;        // rejected by the filter without a descent
+  size_t false_positives;  // passed the filter but the key was absent
+  size_t bytes;
+  double fp_rate;          // false_positives / absent-key finds
+} filter_stats_t;
+
+int rbtree_enable_filter(rbtree *, size_t);
+int rbtree_filter_stats(const rbtree *, filter_stats_t *);
+
+typedef struct {
+  size_t used;           // bytes holding the tree, nodes, filter and buffers
+  size_t reserved;       // bytes taken from the allocator or the kernel
+  double fragmentation;  // 1 - used / reserved
+  size_t nodes;          // nodes allocated, tombstones included
+  int hugepages;         // node arena regions were advised as huge pages
+} memory_usage_t;
+
+memory_usage_t rbtree_memory_usage(const rbtree *);
+int rbtree_enable_hugepages(rbtree *);
+
+// trace file: RBTREE_TRACE_MAGIC, then records of one op byte and a
+// little-endian 32-bit key (the requested n for RBTREE_OP_TO_ARRAY)
+typedef enum {
+  RBTREE_OP_INSERT,
+  RBTREE_OP_FIND,
+  RBTREE_OP_ERASE,
+  RBTREE_OP_MIN,
+  RBTREE_OP_MAX,
+  RBTREE_OP_TO_ARRAY,
+  RBTREE_OP_KINDS
+} rbtree_op_t;
+
+#define RBTREE_TRACE_MAGIC "RBTRACE1"
+#define RBTREE_TRACE_RECORD 5
+
+int rbtree_trace_start(rbtree *, const char *);
+int rbtree_trace_stop(rbtree *);
+
+// tiered mode: a bounded in-memory write buffer that spills to sorted,
+// immutable run files in a directory. Background threads merge runs of
+// similar size, so each record is rewritten about once per size tier.
+// Resident memory is the buffer plus about 2 bytes per key on disk
+// (fence index and run filters). One thread drives the handle.
+typedef struct rbtree_tiered rbtree_tiered;
+
+typedef struct {
+  size_t runs;             // run files currently on disk
+  size_t run_records;      // (key, count delta) records across runs
+  size_t buffered;         // keys and pending erases in the memory buffer
+  size_t merges;           // background merges completed
+  size_t index_bytes;      // fence indexes and filters held in memory
+  size_t flushed_records;  // records written by flushes
+  size_t merged_records;   // records rewritten by merges
+} tiered_stats_t;
+
+rbtree_tiered *rbtree_tiered_open(const char *, size_t);
+void rbtree_tiered_close(rbtree_tiered *);
+int rbtree_tiered_insert(rbtree_tiered *, const key_t);
+int rbtree_tiered_erase(rbtree_tiered *, const key_t);
+int64_t rbtree_tiered_count(rbtree_tiered *, const key_t);
+int rbtree_tiered_flush(rbtree_tiered *);
+int rbtree_tiered_stats(rbtree_tiered *, tiered_stats_t *);
+
+int rbtree_enable_reclamation(rbtree *);
+void rbtree_read_enter(void);
+void rbtree_read_exit(void);
+void rbtree_synchronize(void);
+void rbtree_thread_exit(void);
+
 #endif  // _RBTREE_H_
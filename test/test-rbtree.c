@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 // new_rbtree should return rbtree struct with null root node
 void test_init(void) {
@@ -367,6 +369,577 @@ void test_find_erase_rand(const size_t n, const unsigned int seed) {
   delete_rbtree(t);
 }
 
+static int count_diff(const key_t key, const diff_side_t side, void *arg) {
+  int *counts = (int *)arg;
+  counts[side]++;
+  return 0;
+}
+
+// equal/subset/diff should compare two trees regardless of their shapes
+void test_equal_subset_diff() {
+  const key_t arr1[] = {10, 5, 8, 34, 67, 23, 156, 24, 2, 12, 24};
+  const size_t n1 = sizeof(arr1) / sizeof(arr1[0]);
+  const key_t arr2[] = {24, 12, 2, 24, 156, 23, 67, 34, 8, 5, 10};
+  const key_t arr3[] = {10, 5, 8, 24, 99};
+  const size_t n3 = sizeof(arr3) / sizeof(arr3[0]);
+
+  rbtree *t1 = new_rbtree();
+  rbtree *t2 = new_rbtree();
+  rbtree *t3 = new_rbtree();
+  insert_arr(t1, arr1, n1);
+  insert_arr(t2, arr2, n1);
+  insert_arr(t3, arr3, n3);
+
+  assert(rbtree_equal(t1, t2));
+  assert(rbtree_is_subset(t1, t2));
+  assert(!rbtree_equal(t1, t3));
+  assert(!rbtree_is_subset(t3, t1));
+
+  int counts[2] = {0, 0};
+  assert(rbtree_diff(t1, t3, count_diff, counts) == 0);
+  // t1 only: 34 67 23 156 2 12 24, t3 only: 99
+  assert(counts[RBTREE_ONLY_LEFT] == 7);
+  assert(counts[RBTREE_ONLY_RIGHT] == 1);
+
+  rbtree_erase(t3, rbtree_find(t3, 99));
+  assert(rbtree_is_subset(t3, t1));
+  assert(!rbtree_is_subset(t1, t3));
+
+  // duplicate count matters
+  rbtree_erase(t2, rbtree_find(t2, 24));
+  assert(!rbtree_equal(t1, t2));
+  assert(rbtree_is_subset(t2, t1));
+
+  delete_rbtree(t3);
+  delete_rbtree(t2);
+  delete_rbtree(t1);
+}
+
+// digest should depend only on the key multiset, not on the tree shape
+void test_digest(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % 1000;
+  }
+
+  rbtree *t1 = new_rbtree();
+  rbtree *t2 = new_rbtree();
+  rbtree *plain = new_rbtree();
+  rbtree_enable_digest(t1);
+  insert_arr(t1, arr, n);
+  insert_arr(plain, arr, n);
+  for (int i = n - 1; i >= 0; i--) {
+    rbtree_insert(t2, arr[i]);
+  }
+  assert(rbtree_enable_digest(t2) == 0);
+
+  // only digest trees pay for the hash, moved in when t2 turned it on
+  rbtree *empty = new_rbtree();
+  rbtree *empty_digest = new_rbtree();
+  rbtree_enable_digest(empty_digest);
+  assert(rbtree_memory_usage(t2).used - rbtree_memory_usage(empty_digest).used ==
+         rbtree_memory_usage(plain).used - rbtree_memory_usage(empty).used +
+             n * sizeof(uint64_t));
+  delete_rbtree(empty_digest);
+  delete_rbtree(empty);
+  test_color_constraint(t2);
+  test_search_constraint(t2);
+
+  assert(rbtree_digest(t1) == rbtree_digest(t2));
+  assert(rbtree_digest(t1) == rbtree_digest(plain));
+  assert(rbtree_range_digest(t1, 100, 500) ==
+         rbtree_range_digest(plain, 100, 500));
+  assert(rbtree_equal(t1, t2));
+
+  // erase from both so that the incremental hashes go through erase fixups
+  for (int i = 0; i < n / 2; i++) {
+    rbtree_erase(t1, rbtree_find(t1, arr[i]));
+    rbtree_erase(plain, rbtree_find(plain, arr[i]));
+  }
+  assert(rbtree_digest(t1) == rbtree_digest(plain));
+  assert(rbtree_digest(t1) != rbtree_digest(t2));
+  assert(!rbtree_equal(t1, t2));
+  assert(rbtree_is_subset(t1, t2));
+  assert(!rbtree_is_subset(t2, t1));
+
+  int counts[2] = {0, 0};
+  rbtree_diff(t1, t2, count_diff, counts);
+  assert(counts[RBTREE_ONLY_LEFT] == 0);
+  assert(counts[RBTREE_ONLY_RIGHT] == n / 2);
+
+  test_color_constraint(t1);
+  test_search_constraint(t1);
+
+  free(arr);
+  delete_rbtree(plain);
+  delete_rbtree(t2);
+  delete_rbtree(t1);
+}
+
+// lazy erase should hide tombstones from find, iteration and to_array
+void test_lazy_erase(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % 500;
+  }
+
+  rbtree *t = new_rbtree();
+  rbtree *plain = new_rbtree();
+  assert(rbtree_enable_lazy_erase(t, 0) == 0);
+  rbtree_enable_digest(t);
+  rbtree_enable_digest(plain);
+  insert_arr(t, arr, n);
+  insert_arr(plain, arr, n);
+
+  for (int i = 0; i < n / 2; i++) {
+    node_t *p = rbtree_find(t, arr[i]);
+    assert(p != NULL && p->key == arr[i]);
+    assert(rbtree_erase(t, p) == 0);
+    assert(rbtree_erase(t, p) == -1);
+    rbtree_erase(plain, rbtree_find(plain, arr[i]));
+  }
+  assert(t->tombstones == n / 2);
+  assert(rbtree_equal(t, plain));
+
+  key_t *res = calloc(n, sizeof(key_t));
+  key_t *expected = calloc(n, sizeof(key_t));
+  rbtree_to_array(t, res, n);
+  rbtree_to_array(plain, expected, n);
+  for (int i = 0; i < n - n / 2; i++) {
+    assert(res[i] == expected[i]);
+  }
+
+  int live = 0;
+  for (node_t *p = rbtree_min(t); p != t->nil && p != NULL;
+       p = rbtree_next(t, p)) {
+    live++;
+  }
+  assert(live == n - n / 2);
+  assert(rbtree_min(t)->key == rbtree_min(plain)->key);
+  assert(rbtree_max(t)->key == rbtree_max(plain)->key);
+
+  assert(rbtree_compact(t) == 0);
+  assert(t->tombstones == 0 && t->count == n - n / 2);
+  test_color_constraint(t);
+  test_search_constraint(t);
+  assert(rbtree_equal(t, plain));
+
+  // once a quarter of the nodes are tombstones, erase stops adding more
+  rbtree_enable_lazy_erase(t, 0.25);
+  for (int i = n / 2; i < n; i++) {
+    const size_t before = t->tombstones;
+    rbtree_erase(t, rbtree_find(t, arr[i]));
+    assert(t->tombstones <= 0.25 * t->count + 1 || t->tombstones <= before);
+  }
+  assert(rbtree_min(t) == t->nil);
+  assert(t->count == t->tombstones);
+
+  free(expected);
+  free(res);
+  free(arr);
+  delete_rbtree(plain);
+  delete_rbtree(t);
+}
+
+// cleanup past the tombstone ratio should be spread over later erases: no
+// single erase may free more than a few nodes, and the backlog must drain
+void test_lazy_erase_bounded(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand();
+  }
+
+  rbtree *t = new_rbtree();
+  rbtree_enable_lazy_erase(t, 0);
+  insert_arr(t, arr, n);
+  for (int i = 0; i < n / 2; i++) {
+    rbtree_erase(t, rbtree_find(t, arr[i]));
+  }
+  assert(t->tombstones == n / 2);
+
+  rbtree_enable_lazy_erase(t, 0.25);
+  int i = n / 2;
+  for (; i < n && t->tombstones > 0.25 * t->count; i++) {
+    const size_t count = t->count, tombstones = t->tombstones;
+    rbtree_erase(t, rbtree_find(t, arr[i]));
+    assert(count - t->count <= 9);  // the node itself + one sweep of 8
+    assert(t->tombstones <= tombstones);
+    if (i % 256 == 0) {
+      test_color_constraint(t);
+    }
+  }
+  assert(i < n);  // drained before the live keys ran out
+  test_search_constraint(t);
+
+  free(arr);
+  delete_rbtree(t);
+}
+
+// pop_min/pop_max should return keys in order and update_key should keep
+// the tree ordered whether or not the node has to move
+void test_priority_queue(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = rand() % 1000;
+  }
+
+  rbtree *t = new_rbtree();
+  insert_arr(t, arr, n);
+  qsort((void *)arr, n, sizeof(key_t), comp);
+
+  key_t key;
+  for (int i = 0; i < n / 2; i++) {
+    assert(rbtree_pop_min(t, &key) == 0);
+    assert(key == arr[i]);
+  }
+  for (int i = n - 1; i >= n / 2; i--) {
+    assert(rbtree_pop_max(t, &key) == 0);
+    assert(key == arr[i]);
+  }
+  assert(rbtree_pop_min(t, &key) == -1);
+  assert(t->root == t->nil);
+
+  // move every node: some stay between their neighbours, some relocate
+  node_t **nodes = calloc(n, sizeof(node_t *));
+  for (int i = 0; i < n; i++) {
+    rbtree_insert(t, arr[i]);
+  }
+  int i = 0;
+  for (node_t *p = rbtree_min(t); p != NULL; p = rbtree_next(t, p)) {
+    nodes[i++] = p;
+  }
+  for (i = 0; i < n; i++) {
+    arr[i] = (i % 3 == 0) ? nodes[i]->key : rand() % 1000;
+    assert(rbtree_update_key(t, nodes[i], arr[i]) == nodes[i]);
+    assert(nodes[i]->key == arr[i]);
+  }
+  test_color_constraint(t);
+  test_search_constraint(t);
+
+  qsort((void *)arr, n, sizeof(key_t), comp);
+  assert(rbtree_min(t)->key == arr[0]);
+  assert(rbtree_max(t)->key == arr[n - 1]);
+  for (i = 0; i < n; i++) {
+    assert(rbtree_pop_min(t, &key) == 0);
+    assert(key == arr[i]);
+  }
+
+  free(nodes);
+  free(arr);
+  delete_rbtree(t);
+}
+
+// hinted inserts should land in order no matter how far the hint is
+void test_insert_hint(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  key_t *res = calloc(n, sizeof(key_t));
+
+  for (int pattern = 0; pattern < 3; pattern++) {
+    rbtree *t = new_rbtree();
+    node_t *hint = NULL;
+    for (int i = 0; i < n; i++) {
+      if (pattern == 0) {
+        arr[i] = i / 2;  // sorted with duplicates
+      } else if (pattern == 1) {
+        arr[i] = n - i;  // reverse sorted
+      } else {
+        arr[i] = i * 4 + rand() % 64 - 32;  // jittered
+      }
+      hint = rbtree_insert_hint(t, hint, arr[i]);
+      assert(hint != NULL && hint->key == arr[i]);
+    }
+    // a hint far from the key still has to work
+    rbtree_insert_hint(t, rbtree_min(t), n * 8);
+    rbtree_insert_hint(t, rbtree_max(t), -1);
+
+    // erase two thirds, checking the finger is dropped with its node
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+      rbtree_erase(t, rbtree_find(t, arr[i]));
+      if (i % 3 == 0) {
+        rbtree_insert(t, arr[i]);
+        arr[m++] = arr[i];
+      }
+    }
+    arr[m++] = n * 8;
+    arr[m++] = -1;
+    test_color_constraint(t);
+    test_search_constraint(t);
+
+    qsort((void *)arr, m, sizeof(key_t), comp);
+    rbtree_to_array(t, res, m);
+    for (int i = 0; i < m; i++) {
+      assert(arr[i] == res[i]);
+    }
+    delete_rbtree(t);
+  }
+
+  free(res);
+  free(arr);
+}
+
+// the filter must never hide a key that is in the tree
+void test_filter(const size_t n, const unsigned int seed) {
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (int i = 0; i < n; i++) {
+    arr[i] = (rand() % 100000) * 2;  // even keys only
+  }
+
+  rbtree *t = new_rbtree();
+  filter_stats_t stats;
+  assert(rbtree_filter_stats(t, &stats) == -1);
+  assert(rbtree_enable_filter(t, 16) == 0);  // has to grow on the way
+  insert_arr(t, arr, n);
+  rbtree_enable_lazy_erase(t, 0.5);
+
+  for (int i = 0; i < n; i++) {
+    node_t *p = rbtree_find(t, arr[i]);
+    assert(p != NULL && p->key == arr[i]);
+  }
+  for (int i = 0; i < n; i++) {
+    assert(rbtree_find(t, arr[i] + 1) == NULL);
+  }
+  assert(rbtree_filter_stats(t, &stats) == 0);
+  assert(stats.queries == 2 * n);
+  assert(stats.negatives + stats.false_positives == n);
+  assert(stats.fp_rate < 0.05);
+
+  // erased keys (tombstoned, compacted or relocated) should stay consistent
+  for (int i = 0; i < n / 2; i++) {
+    rbtree_erase(t, rbtree_find(t, arr[i]));
+  }
+  for (int i = n / 2; i < n; i += 2) {
+    rbtree_update_key(t, rbtree_find(t, arr[i]), arr[i] + 1);
+    arr[i]++;
+  }
+  for (int i = n / 2; i < n; i++) {
+    node_t *p = rbtree_find(t, arr[i]);
+    assert(p != NULL && p->key == arr[i]);
+    rbtree_erase(t, p);
+  }
+  rbtree_compact(t);
+  assert(t->root == t->nil);
+  test_find_erase(t, arr, n);
+
+  free(arr);
+  delete_rbtree(t);
+}
+
+// trace should snapshot live keys, then log each public call in order
+void test_trace(void) {
+  char path[] = "/tmp/rbtree-trace-XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+
+  rbtree *t = new_rbtree();
+  assert(rbtree_trace_stop(t) == -1);
+  rbtree_insert(t, 20);
+  rbtree_insert(t, 10);
+  rbtree_erase(t, rbtree_find(t, 20));
+
+  assert(rbtree_trace_start(t, path) == 0);
+  assert(rbtree_trace_start(t, path) == -1);
+  rbtree_insert(t, -7);
+  rbtree_find(t, 42);
+  rbtree_min(t);
+  rbtree_max(t);
+  key_t arr[4];
+  rbtree_to_array(t, arr, 4);
+  rbtree_update_key(t, rbtree_find(t, -7), 30);
+  key_t key;
+  rbtree_pop_min(t, &key);
+  assert(rbtree_trace_stop(t) == 0);
+  rbtree_insert(t, 99);  // not recorded
+
+  const struct {
+    int op;
+    key_t key;
+  } expected[] = {
+      {RBTREE_OP_INSERT, 10}, {RBTREE_OP_INSERT, -7}, {RBTREE_OP_FIND, 42},
+      {RBTREE_OP_MIN, 0},     {RBTREE_OP_MAX, 0},     {RBTREE_OP_TO_ARRAY, 4},
+      {RBTREE_OP_FIND, -7},   {RBTREE_OP_ERASE, -7},  {RBTREE_OP_INSERT, 30},
+      {RBTREE_OP_ERASE, 10}};
+  const size_t n = sizeof(expected) / sizeof(expected[0]);
+
+  FILE *in = fopen(path, "rb");
+  assert(in != NULL);
+  char magic[sizeof(RBTREE_TRACE_MAGIC) - 1];
+  assert(fread(magic, sizeof(magic), 1, in) == 1);
+  assert(memcmp(magic, RBTREE_TRACE_MAGIC, sizeof(magic)) == 0);
+  for (size_t i = 0; i < n; i++) {
+    unsigned char rec[RBTREE_TRACE_RECORD];
+    assert(fread(rec, sizeof(rec), 1, in) == 1);
+    const key_t k = (key_t)(rec[1] | (uint32_t)rec[2] << 8 |
+                            (uint32_t)rec[3] << 16 | (uint32_t)rec[4] << 24);
+    assert(rec[0] == expected[i].op && k == expected[i].key);
+  }
+  assert(fgetc(in) == EOF);
+  fclose(in);
+  unlink(path);
+
+  assert(rbtree_trace_start(t, path) == 0);
+  delete_rbtree(t);  // stops the trace
+  unlink(path);
+}
+
+// order-sensitive fold: keys seen through map and combine must stay sorted
+typedef struct {
+  long long sum;
+  size_t count;
+  key_t first, last;
+  bool sorted;
+} fold_t;
+
+static void fold_map(void *acc, const key_t key, void *arg) {
+  fold_t *f = acc;
+  if (f->count == 0) {
+    f->first = key;
+  } else if (key < f->last) {
+    f->sorted = false;
+  }
+  f->last = key;
+  f->sum += key;
+  f->count++;
+}
+
+static void fold_combine(void *acc, const void *other, void *arg) {
+  fold_t *f = acc;
+  const fold_t *g = other;
+  if (g->count == 0) {
+    return;
+  }
+  if (f->count == 0) {
+    *f = *g;
+    return;
+  }
+  f->sorted = f->sorted && g->sorted && f->last <= g->first;
+  f->last = g->last;
+  f->sum += g->sum;
+  f->count += g->count;
+}
+
+// parallel export and reduce should match the sequential walk
+void test_parallel(const size_t n, const unsigned int seed) {
+  srand(seed);
+  rbtree *t = new_rbtree();
+  for (size_t i = 0; i < n; i++) {
+    rbtree_insert(t, rand() % (n / 2));  // with duplicates
+  }
+  rbtree_enable_lazy_erase(t, 0);  // keep tombstones around
+  for (size_t i = 0; i < n / 4; i++) {
+    node_t *p = rbtree_find(t, rand() % (n / 2));
+    if (p != NULL) {
+      rbtree_erase(t, p);
+    }
+  }
+  const size_t live = t->count - t->tombstones;
+
+  key_t *expected = calloc(live, sizeof(key_t));
+  key_t *res = calloc(live + 1, sizeof(key_t));
+  rbtree_to_array(t, expected, live);
+  long long sum = 0;
+  for (size_t i = 0; i < live; i++) {
+    sum += expected[i];
+  }
+
+  const int threads[] = {0, 1, 2, 3, 8, 2000000};  // absurd counts get clamped
+  for (int k = 0; k < 6; k++) {
+    res[live] = -1;  // guard
+    assert(rbtree_to_array_parallel(t, res, live + 1, threads[k]) == 0);
+    assert(res[live] == -1);
+    for (size_t i = 0; i < live; i++) {
+      assert(res[i] == expected[i]);
+    }
+    // truncated export
+    const size_t m = live / 3;
+    res[m] = -1;
+    assert(rbtree_to_array_parallel(t, res, m, threads[k]) == 0);
+    assert(res[m] == -1);
+    for (size_t i = 0; i < m; i++) {
+      assert(res[i] == expected[i]);
+    }
+
+    fold_t f = {0, 0, 0, 0, true};
+    assert(rbtree_parallel_reduce(t, &f, sizeof(f), fold_map, fold_combine,
+                                  NULL, threads[k]) == 0);
+    assert(f.count == live && f.sum == sum && f.sorted);
+    assert(f.first == expected[0] && f.last == expected[live - 1]);
+  }
+
+  free(expected);
+  free(res);
+  delete_rbtree(t);
+}
+
+// memory accounting should follow node counts, and the huge page arena
+// should behave like the heap, reusing freed nodes before growing
+void test_memory_usage(const size_t n, const unsigned int seed) {
+  rbtree *t = new_rbtree();
+  memory_usage_t empty = rbtree_memory_usage(t);
+  assert(empty.nodes == 0 && empty.used > 0 && empty.reserved >= empty.used);
+
+  srand(seed);
+  key_t *arr = calloc(n, sizeof(key_t));
+  for (size_t i = 0; i < n; i++) {
+    arr[i] = i * 2;
+  }
+  for (size_t i = n - 1; i > 0; i--) {  // shuffle, keys stay distinct
+    const size_t j = rand() % (i + 1);
+    const key_t tmp = arr[i];
+    arr[i] = arr[j];
+    arr[j] = tmp;
+  }
+  insert_arr(t, arr, n);
+  memory_usage_t heap = rbtree_memory_usage(t);
+  assert(heap.nodes == n);
+  assert(heap.used == empty.used + n * sizeof(node_t));
+  assert(heap.reserved >= heap.used);
+  assert(heap.fragmentation >= 0 && heap.fragmentation < 1);
+  assert(rbtree_enable_hugepages(t) == -1);  // not empty
+
+  rbtree *h = new_rbtree();
+  assert(rbtree_enable_hugepages(h) == 0);
+  assert(rbtree_enable_reclamation(h) == -1);
+  insert_arr(h, arr, n);
+  memory_usage_t arena = rbtree_memory_usage(h);
+  assert(arena.nodes == n && arena.used >= n * sizeof(node_t));
+  assert(arena.reserved >= arena.used);
+  assert(rbtree_equal(t, h));
+  assert(rbtree_enable_digest(h) == -1);  // arena nodes cannot grow
+
+  // erased nodes go to the free list and come back on the next inserts
+  for (size_t i = 0; i < n / 2; i++) {
+    rbtree_erase(h, rbtree_find(h, arr[i]));
+  }
+  assert(rbtree_memory_usage(h).nodes == n - n / 2);
+  assert(rbtree_memory_usage(h).fragmentation > arena.fragmentation);
+  insert_arr(h, arr, n / 2);
+  assert(rbtree_memory_usage(h).reserved == arena.reserved);
+  assert(rbtree_equal(t, h));
+  delete_rbtree(h);
+
+  h = new_rbtree();
+  assert(rbtree_enable_reclamation(h) == 0);
+  assert(rbtree_enable_hugepages(h) == -1);
+  delete_rbtree(h);
+
+  // a fresh arena tree should pass the usual find/erase round trip
+  h = new_rbtree();
+  assert(rbtree_enable_hugepages(h) == 0);
+  test_find_erase(h, arr, n);
+  delete_rbtree(h);
+
+  free(arr);
+  delete_rbtree(t);
+}
+
 int main(void) {
   test_init();
   test_insert_single(1024);
@@ -379,5 +952,15 @@ int main(void) {
   test_duplicate_values();
   test_multi_instance();
   test_find_erase_rand(10000, 17);
+  test_equal_subset_diff();
+  test_digest(2000, 29);
+  test_lazy_erase(2000, 41);
+  test_lazy_erase_bounded(20000, 43);
+  test_priority_queue(2000, 53);
+  test_insert_hint(2000, 67);
+  test_filter(5000, 79);
+  test_trace();
+  test_parallel(40000, 89);
+  test_memory_usage(50000, 97);
   printf("Passed all tests!\n");
 }
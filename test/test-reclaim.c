@@ -0,0 +1,105 @@
+#include <assert.h>
+#include <pthread.h>
+#include <rbtree.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Readers search the tree without locks while a single writer keeps
+// inserting and erasing. Run under valgrind (or -fsanitize=address), any
+// node freed before its readers left would show up as an invalid read.
+
+#define N_READERS 3
+#define N_KEYS 512
+#define N_WRITES 20000
+
+static rbtree *tree;
+static atomic_int done = 0;
+
+static void *reader(void *arg) {
+  unsigned int seed = (unsigned int)(size_t)arg;
+  long hits = 0;
+
+  while (!atomic_load(&done)) {
+    rbtree_read_enter();
+    for (int i = 0; i < 64; i++) {
+      const key_t key = rand_r(&seed) % N_KEYS;
+      node_t *p = rbtree_find(tree, key);
+      if (p != NULL) {
+        assert(p->key == key);
+        hits++;
+      }
+    }
+    rbtree_read_exit();
+  }
+
+  rbtree_thread_exit();
+  return (void *)hits;
+}
+
+static void *writer(void *arg) {
+  unsigned int seed = (unsigned int)(size_t)arg;
+
+  for (int i = 0; i < N_WRITES; i++) {
+    const key_t key = rand_r(&seed) % N_KEYS;
+    node_t *p = rbtree_find(tree, key);
+    if (p != NULL && (rand_r(&seed) & 1)) {
+      rbtree_erase(tree, p);
+    } else {
+      rbtree_insert(tree, key);
+    }
+  }
+
+  atomic_store(&done, 1);
+  rbtree_thread_exit();
+  return NULL;
+}
+
+// nested read sections and synchronize with no readers should not block
+void test_read_section_nesting() {
+  rbtree *t = new_rbtree();
+  rbtree_enable_reclamation(t);
+  for (int i = 0; i < 1000; i++) {
+    rbtree_insert(t, i);
+  }
+
+  rbtree_read_enter();
+  rbtree_read_enter();
+  node_t *p = rbtree_find(t, 10);
+  rbtree_read_exit();
+  assert(p != NULL && p->key == 10);
+  rbtree_read_exit();
+
+  for (int i = 0; i < 1000; i++) {
+    rbtree_erase(t, rbtree_find(t, i));
+  }
+  rbtree_synchronize();
+  delete_rbtree(t);
+}
+
+void test_concurrent_readers() {
+  pthread_t readers[N_READERS], w;
+
+  tree = new_rbtree();
+  assert(tree != NULL);
+  rbtree_enable_reclamation(tree);
+  rbtree_enable_lazy_erase(tree, 0.3);
+
+  for (int i = 0; i < N_READERS; i++) {
+    pthread_create(&readers[i], NULL, reader, (void *)(size_t)(i + 1));
+  }
+  pthread_create(&w, NULL, writer, (void *)(size_t)7);
+
+  pthread_join(w, NULL);
+  for (int i = 0; i < N_READERS; i++) {
+    pthread_join(readers[i], NULL);
+  }
+
+  delete_rbtree(tree);
+}
+
+int main(void) {
+  test_read_section_nesting();
+  test_concurrent_readers();
+  printf("Passed all tests!\n");
+}
@@ -0,0 +1,248 @@
+#include <assert.h>
+#include <limits.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Built against a library compiled with -DRBTREE_SMALL_MODE, so every tree
+// starts as a sorted inline key array and switches to the red-black layout
+// past 8 keys without any call. Keys are checked against a count array.
+
+#define N_KEYS 64
+
+static void assert_same_keys(const rbtree *t, const int *ref) {
+  key_t res[N_KEYS * 4], expected[N_KEYS * 4];
+  size_t n = 0;
+  for (key_t k = 0; k < N_KEYS; k++) {
+    for (int c = 0; c < ref[k]; c++) {
+      expected[n++] = k;
+    }
+    assert((rbtree_find(t, k) != NULL) == (ref[k] > 0));
+  }
+  assert(t->count == n);
+  if (n == 0) {
+    assert(rbtree_min(t) == t->nil);
+    return;
+  }
+  assert(rbtree_to_array(t, res, n) == 0);
+  for (size_t i = 0; i < n; i++) {
+    assert(res[i] == expected[i]);
+  }
+  assert(rbtree_min(t)->key == expected[0]);
+  assert(rbtree_max(t)->key == expected[n - 1]);
+}
+
+// black height of the subtree, -1 if a color or order rule is broken
+static int check_rb(const rbtree *t, const node_t *p, const key_t lo,
+                    const key_t hi) {
+  if (p == t->nil) {
+    return 0;
+  }
+  if (p->key < lo || p->key > hi) {
+    return -1;
+  }
+  if (p->color == RBTREE_RED && (p->left->color == RBTREE_RED ||
+                                 p->right->color == RBTREE_RED)) {
+    return -1;
+  }
+  const int l = check_rb(t, p->left, lo, p->key);
+  const int r = check_rb(t, p->right, p->key, hi);
+  if (l < 0 || l != r) {
+    return -1;
+  }
+  return l + (p->color == RBTREE_BLACK);
+}
+
+// a fresh tree is an empty array and insert keeps returning the root
+void test_init(void) {
+  rbtree *t = new_rbtree();
+  assert(t != NULL);
+  assert(t->small_array);
+  assert(t->root == t->nil);
+
+  node_t *root = rbtree_insert(t, 7);
+  assert(root != NULL && root == t->root);
+  node_t *p = rbtree_find(t, 7);
+  assert(p != NULL && p->key == 7);
+  assert(rbtree_erase(t, p) == 0);
+  assert(rbtree_find(t, 7) == NULL);
+  assert(t->count == 0);
+
+  delete_rbtree(t);
+}
+
+// INT_MAX and INT_MIN are ordinary keys, also in a full array
+void test_extreme_keys(void) {
+  rbtree *t = new_rbtree();
+  assert(rbtree_find(t, INT_MAX) == NULL);
+  assert(rbtree_find(t, INT_MIN) == NULL);
+
+  rbtree_insert(t, INT_MAX);
+  rbtree_insert(t, INT_MIN);
+  node_t *p = rbtree_find(t, INT_MAX);
+  assert(p != NULL && p->key == INT_MAX);
+  p = rbtree_find(t, INT_MIN);
+  assert(p != NULL && p->key == INT_MIN);
+  assert(rbtree_max(t)->key == INT_MAX);
+  assert(rbtree_min(t)->key == INT_MIN);
+
+  // fill all 8 slots with INT_MAX at the end
+  for (int i = 0; i < 6; i++) {
+    rbtree_insert(t, INT_MAX);
+  }
+  assert(t->small_array && t->count == 8);
+  key_t arr[9];
+  assert(rbtree_to_array(t, arr, 8) == 0);
+  assert(arr[0] == INT_MIN);
+  for (int i = 1; i < 8; i++) {
+    assert(arr[i] == INT_MAX);
+  }
+  assert(rbtree_erase(t, rbtree_find(t, INT_MAX)) == 0);
+  assert(rbtree_find(t, INT_MAX) != NULL);
+  assert(rbtree_pop_min(t, &arr[0]) == 0 && arr[0] == INT_MIN);
+  assert(rbtree_find(t, INT_MIN) == NULL);
+
+  // one past the array promotes, the extremes are still found
+  for (int i = 0; i < 3; i++) {
+    rbtree_insert(t, INT_MIN);
+  }
+  assert(!t->small_array && t->count == 9);
+  assert(rbtree_find(t, INT_MAX) != NULL);
+  assert(rbtree_find(t, INT_MIN) != NULL);
+  assert(check_rb(t, t->root, INT_MIN, INT_MAX) >= 0);
+
+  delete_rbtree(t);
+}
+
+// small mode should behave like a plain tree across promotion and demotion
+void test_small_mode(const unsigned int seed) {
+  int ref[N_KEYS] = {0};
+  srand(seed);
+  rbtree *t = new_rbtree();
+  rbtree_enable_filter(t, 64);
+
+  // a node inserted first has to keep its address through the switches
+  node_t *pinned = rbtree_insert_hint(t, NULL, 60);
+  assert(pinned != NULL && pinned->key == 60);
+  assert(t->root == t->nil);  // array mode
+  ref[60]++;
+
+  int promoted = 0, demoted = 0;
+  for (int round = 0; round < 2000; round++) {
+    // grow towards ~40 keys, then shrink back to the pinned one, repeatedly
+    const int grow = (round / 200) % 2 == 0;
+    const key_t key = rand() % 50;
+    const int was_array = t->small_array;
+    if ((grow && t->count < 40) || rand() % 8 == 0) {
+      assert(rbtree_insert(t, key) == t->root);
+      ref[key]++;
+    } else {
+      node_t *p = rbtree_find(t, key);
+      assert((p == NULL) == (ref[key] == 0));
+      if (p != NULL) {
+        assert(p->key == key);
+        if (rand() % 2) {
+          rbtree_erase(t, p);
+        } else {
+          rbtree_update_key(t, p, key + 7);
+          ref[key + 7]++;
+        }
+        ref[key]--;
+      } else if (rbtree_min(t)->key != 60) {
+        key_t popped;
+        assert(rbtree_pop_min(t, &popped) == 0 && ref[popped] > 0);
+        ref[popped]--;
+      }
+    }
+    promoted += was_array && !t->small_array;
+    demoted += !was_array && t->small_array;
+    assert(pinned->key == 60);
+    assert_same_keys(t, ref);
+    if (!t->small_array) {
+      assert(check_rb(t, t->root, INT_MIN, INT_MAX) >= 0);
+    }
+  }
+  assert(promoted > 0 && demoted > 0);
+
+  delete_rbtree(t);
+}
+
+// the array and its first nodes live in the tree allocation, so a tree that
+// stays small costs no node allocations beyond it
+void test_memory(void) {
+  rbtree *t = new_rbtree();
+  const memory_usage_t empty = rbtree_memory_usage(t);
+  for (key_t k = 0; k < 8; k++) {
+    rbtree_insert(t, k);
+  }
+  memory_usage_t usage = rbtree_memory_usage(t);
+  assert(t->small_array && usage.nodes == 8);
+  assert(usage.used == empty.used && usage.reserved == empty.reserved);
+
+  // promotion links the same nodes, only the ninth is allocated
+  node_t *first = rbtree_find(t, 0);
+  rbtree_insert(t, 8);
+  usage = rbtree_memory_usage(t);
+  assert(!t->small_array && rbtree_find(t, 0) == first);
+  assert(usage.used == empty.used + sizeof(node_t));
+  assert(check_rb(t, t->root, INT_MIN, INT_MAX) >= 0);
+
+  // a freed inline slot is reused before the heap
+  rbtree_erase(t, first);
+  rbtree_insert(t, 20);
+  assert(rbtree_memory_usage(t).used == usage.used);
+  assert(rbtree_find(t, 20) == first);
+
+  delete_rbtree(t);
+}
+
+// digest nodes do not fit the inline slots, so digest leaves small mode
+void test_digest(void) {
+  rbtree *t = new_rbtree();
+  rbtree *plain = new_rbtree();
+  for (key_t k = 0; k < 5; k++) {
+    rbtree_insert(t, k);
+    rbtree_insert(plain, k);
+  }
+  assert(rbtree_enable_digest(t) == 0);
+  assert(!t->small_array && t->count == 5);
+  assert(check_rb(t, t->root, INT_MIN, INT_MAX) >= 0);
+  assert(rbtree_digest(t) == rbtree_digest(plain));
+  for (key_t k = 0; k < 4; k++) {
+    rbtree_erase(t, rbtree_find(t, k));
+    rbtree_erase(plain, rbtree_find(plain, k));
+    assert(!t->small_array);
+    assert(rbtree_equal(t, plain));
+  }
+  delete_rbtree(plain);
+  delete_rbtree(t);
+}
+
+// reclamation promotes the tree for good, readers never see the array
+void test_reclamation(void) {
+  rbtree *t = new_rbtree();
+  for (key_t k = 0; k < 5; k++) {
+    rbtree_insert(t, k);
+  }
+  assert(rbtree_enable_reclamation(t) == 0);
+  assert(!t->small_array && t->root != t->nil);
+  assert(check_rb(t, t->root, INT_MIN, INT_MAX) >= 0);
+  for (key_t k = 0; k < 5; k++) {
+    node_t *p = rbtree_find(t, k);
+    assert(p != NULL && p->key == k);
+    rbtree_erase(t, p);
+    assert(!t->small_array);
+  }
+  rbtree_synchronize();
+  delete_rbtree(t);
+}
+
+int main(void) {
+  test_init();
+  test_extreme_keys();
+  test_small_mode(83);
+  test_memory();
+  test_digest();
+  test_reclamation();
+  printf("Passed all tests!\n");
+}
@@ -0,0 +1,80 @@
+#include <assert.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Tiered mode keeps a small write buffer in memory and spills to run files
+// merged in the background. Counts are checked against a plain array while
+// flushes and merges happen underneath, then the directory must be empty
+// again after close.
+
+#define N_KEYS 2000
+#define N_OPS 200000
+#define BUFFER_KEYS 512
+
+static void check_counts(rbtree_tiered *tt, const int *ref) {
+  for (key_t k = 0; k < N_KEYS; k++) {
+    assert(rbtree_tiered_count(tt, k) == ref[k]);
+  }
+  assert(rbtree_tiered_count(tt, -1) == 0);
+  assert(rbtree_tiered_count(tt, N_KEYS) == 0);
+}
+
+// random inserts and erases of duplicate keys through many flushes
+void test_tiered_multiset(const char *dir, const unsigned int seed) {
+  int *ref = calloc(N_KEYS, sizeof(int));
+  rbtree_tiered *tt = rbtree_tiered_open(dir, BUFFER_KEYS);
+  assert(tt != NULL);
+
+  srand(seed);
+  for (int i = 0; i < N_OPS; i++) {
+    const key_t k = rand() % N_KEYS;
+    if (rand() % 3) {
+      assert(rbtree_tiered_insert(tt, k) == 0);
+      ref[k]++;
+    } else if (ref[k] > 0) {
+      assert(rbtree_tiered_erase(tt, k) == 0);
+      ref[k]--;
+    } else {
+      assert(rbtree_tiered_erase(tt, k) == -1);
+    }
+    if (i % 20000 == 0) {
+      check_counts(tt, ref);
+    }
+  }
+  check_counts(tt, ref);
+
+  tiered_stats_t stats;
+  assert(rbtree_tiered_stats(tt, &stats) == 0);
+  assert(stats.buffered < BUFFER_KEYS);
+  assert(stats.runs >= 1 && stats.runs <= 32);
+  assert(stats.merges > 0);
+  // size-tiered merging rewrites a record about once per tier, not once per
+  // merge, so merge output stays a small multiple of what was flushed
+  assert(stats.flushed_records > 0);
+  assert(stats.merged_records <= 6 * stats.flushed_records);
+
+  // everything on disk, then erase it all back to nothing
+  assert(rbtree_tiered_flush(tt) == 0);
+  assert(rbtree_tiered_stats(tt, &stats) == 0 && stats.buffered == 0);
+  check_counts(tt, ref);
+  for (key_t k = 0; k < N_KEYS; k++) {
+    while (ref[k] > 0) {
+      assert(rbtree_tiered_erase(tt, k) == 0);
+      ref[k]--;
+    }
+  }
+  check_counts(tt, ref);
+
+  rbtree_tiered_close(tt);
+  free(ref);
+}
+
+int main(void) {
+  char dir[] = "/tmp/rbtree-tiered-XXXXXX";
+  assert(mkdtemp(dir) != NULL);
+  test_tiered_multiset(dir, 97);
+  assert(rmdir(dir) == 0);  // close removes every run file
+  printf("Passed all tests!\n");
+}